@@ -21,7 +21,13 @@
  Copyright (c) 2023 Bill Zissimopoulos. All rights reserved.
  
  MurmurHash3 was written by Austin Appleby, and is placed in the public
- domain. The author hereby disclaims copyright to this source code. */
+ domain. The author hereby disclaims copyright to this source code.
+ 
+ wyhash was written by Wang Yi and is released into the public domain
+ (https://github.com/wangyi-fudan/wyhash).
+ 
+ XXH3 is based off https://github.com/Cyan4973/xxHash
+ Copyright (c) 2012-2021 Yann Collet. All rights reserved. (BSD 2-Clause) */
 
 #ifndef EZMAP_HEADER
 #define EZMAP_HEADER
@@ -29,6 +35,17 @@
 extern "C" {
 #endif
 
+// Large trees use mmap's MAP_ANONYMOUS, which strict -std=c11 hides. This only
+// works if ezmap.h comes before any system header, otherwise /dev/zero is mapped
+#if defined(EZMAP_LARGE) && (defined(EZMAP_IMPLEMENTATION) || defined(EZ_IMPLEMENTATION)) && !defined(_WIN32) && !defined(_WIN64)
+#if !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+#if defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+#define _DARWIN_C_SOURCE
+#endif
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
@@ -43,12 +60,64 @@ extern "C" {
 #ifndef EZMAP_DEFAULT_CAPACITY
 #define EZMAP_DEFAULT_CAPACITY 8
 #endif
+// Number of keys walked at once by ezKeyMapGetMany/ezKeyMapSetMany
+#ifndef EZMAP_BATCH_WIDTH
+#define EZMAP_BATCH_WIDTH 16
+#endif
+// Default number of shards for ezConcurrentKeyMap, and the number of per-thread
+// reader slots, threads beyond this share slots (correct, but they contend)
+#ifndef EZMAP_DEFAULT_SHARDS
+#define EZMAP_DEFAULT_SHARDS 64
+#endif
+#ifndef EZMAP_READER_SLOTS
+#define EZMAP_READER_SLOTS 64
+#endif
+// Define EZMAP_LARGE for trees bigger than 512MB (a few million keys), trie
+// slots become 64-bit so every node doubles in size. Large trees reserve
+// EZMAP_LARGE_GROWTH times the address space they start with and commit it as
+// they grow, a tree that outgrows that moves once into a reservation as many
+// times bigger again. An empty map reserves a few hundred KB
+#ifndef EZMAP_LARGE_GROWTH
+#define EZMAP_LARGE_GROWTH 64
+#endif
+#ifndef EZMAP_HASH_SEED
+#define EZMAP_HASH_SEED 0
+#endif
+#ifndef EZMAP_BLOOM_RATE
+#define EZMAP_BLOOM_RATE 0.01
+#endif
 
 typedef struct imap_node_t imap_node_t;
+typedef struct ezDictArena ezDictArena;
+
+// Blocked Bloom filter, each key sets one bit in each of the 8 words of a 64
+// byte block so a lookup reads a single cache line. ezBloomHas returning 0 means
+// the key was never added, 1 means it probably was. Keys can't be removed
+typedef struct {
+    uint64_t *blocks;
+    size_t blockCount;
+    size_t count, capacity; // keys added, keys the filter was sized for
+    double falsePositiveRate;
+} ezBloom;
+
+// The false positive rate holds up to `capacity` keys and climbs past it. A
+// `falsePositiveRate` of 0 uses EZMAP_BLOOM_RATE
+ezBloom* ezBloomNew(size_t capacity, double falsePositiveRate);
+void ezBloomAdd(ezBloom *bloom, uint64_t key);
+int ezBloomHas(ezBloom *bloom, uint64_t key);
+// Byte strings are reduced to a key with ezHash
+void ezBloomAddBytes(ezBloom *bloom, const void *data, size_t length);
+int ezBloomHasBytes(ezBloom *bloom, const void *data, size_t length);
+void ezBloomClear(ezBloom *bloom);
+void ezBloomDestroy(ezBloom *bloom);
 
 typedef struct {
     imap_node_t *tree;
     size_t count, capacity;
+    size_t mapped;        // size of the file mapping for maps from ezKeyMapMap, otherwise 0
+    size_t valueSize;     // bytes stored per key by maps from ezKeyMapNewTyped, otherwise 0
+    ezDictArena *strings; // interned keys once the map is used as an ezDict, otherwise NULL
+    ezBloom *filter;      // see ezKeyMapAddFilter, otherwise NULL
 } ezKeyMap;
 
 typedef struct {
@@ -56,13 +125,230 @@ typedef struct {
     void *val;
 } ezKeyValuePair;
 
+// Values below 2^26 (2^58 with EZMAP_LARGE, which covers any pointer) are kept
+// in the trie itself, only bigger values take up a separate 8 byte cell
 ezKeyMap* ezKeyMapNew(ezKeyMap *old, size_t capacity);
 int ezKeyMapSet(ezKeyMap *map, uint64_t key, void *value);
 void* ezKeyMapGet(ezKeyMap *map, uint64_t key);
 void* ezKeyMapDel(ezKeyMap *map, uint64_t key);
+// Same as Del without the value, returns 1 if `key` was removed
+int ezKeyMapRemove(ezKeyMap *map, uint64_t key);
+// Typed maps store a `valueSize` byte value in the tree for each key instead of
+// a pointer. Set copies `valueSize` bytes from `value` (zeroes if NULL), Get
+// returns a pointer to the stored copy that is valid until the map is next
+// modified. The copy is gone once the key is deleted, so Del returns
+// EZMAP_REMOVED rather than a pointer to it (use ezKeyMapRemove instead). Sizes
+// are rounded up to 8 bytes and can be up to 64 (128 with EZMAP_LARGE), returns
+// NULL for anything bigger
+#define EZMAP_REMOVED ((void*)1)
+ezKeyMap* ezKeyMapNewTyped(size_t valueSize, size_t capacity);
+#define ezKeyMapNewOf(T, capacity) ezKeyMapNewTyped(sizeof(T), (capacity))
+
+// Key sets are maps without values, a key takes up nothing but its trie slot
+typedef ezKeyMap ezKeySet;
+#define ezKeySetNew(capacity) ezKeyMapNew(NULL, (capacity))
+int ezKeySetAdd(ezKeySet *set, uint64_t key);
+int ezKeySetHas(ezKeySet *set, uint64_t key);
+// Returns 1 if `key` was in the set
+int ezKeySetRemove(ezKeySet *set, uint64_t key);
+#define ezKeySetDestroy(set) ezKeyMapDestroy(set)
+// Batched Get/Set for large numbers of independent keys. Several trie paths are
+// walked at once, prefetching the next node of each so the cache misses overlap.
+// `results[i]` is NULL if `keys[i]` isn't found, returns the number found
+size_t ezKeyMapGetMany(ezKeyMap *map, const uint64_t *keys, void **results, size_t count);
+// Returns the number of keys set, only less than `count` if the map couldn't grow
+size_t ezKeyMapSetMany(ezKeyMap *map, const uint64_t *keys, void **values, size_t count);
 int ezKeyMapEach(ezKeyMap *map, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata);
+
+// Cursors walk the keys in ascending order (the trie keeps them sorted) and can
+// start anywhere. A cursor is only valid until the map is next modified
+typedef struct {
+    ezKeyMap *map;
+    uint64_t key;
+    void *value;
+    uint64_t path[16]; // node offsets from the root down, direction taken in the low bits
+    size_t depth;      // 0 once the cursor has run off either end
+} ezKeyMapCursor;
+
+// Moves to the first key >= `key`, these all return 0 if there is no such key
+int ezKeyMapSeek(ezKeyMap *map, ezKeyMapCursor *cursor, uint64_t key);
+int ezKeyMapFirst(ezKeyMap *map, ezKeyMapCursor *cursor);
+int ezKeyMapLast(ezKeyMap *map, ezKeyMapCursor *cursor);
+int ezKeyMapNext(ezKeyMapCursor *cursor);
+int ezKeyMapPrev(ezKeyMapCursor *cursor);
+// Calls `callback` for every key in [from, to) in order, only the subtrees that
+// overlap the range are visited. Stops early if `callback` returns 0, returns
+// the number of keys visited
+size_t ezKeyMapRange(ezKeyMap *map, uint64_t from, uint64_t to, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata);
+// Same as ezKeyMapRange for every key whose top `bits` bits match `prefix`
+size_t ezKeyMapPrefix(ezKeyMap *map, uint64_t prefix, unsigned int bits, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata);
+// Include ezthreads.h before this header to walk a map on a thread pool
+#if defined(EZTHREADS_HEADER)
+// The top of the trie is split into subtrees which up to `parts` tasks on `pool`
+// take from a shared counter until none are left. `callback` is given the index
+// (below `parts`) of the task calling it, so state can be kept per part without
+// locking. Order is only kept within a subtree. If `callback` returns 0 every
+// part stops early. `reduce`, if not NULL, is then called for each part in turn
+// on the calling thread. Returns the number of keys visited, or 0 without
+// calling anything if the work couldn't be allocated
+size_t ezKeyMapEachParallel(ezThreadPool *pool, ezKeyMap *map, size_t parts,
+                            int(*callback)(ezKeyValuePair *pair, size_t part, void *userdata),
+                            void(*reduce)(size_t part, void *userdata), void *userdata);
+#endif
+// Rebuilds the tree without the free space left behind by deletes, nodes are
+// laid out depth first so a lookup's path is close together. The new tree is
+// sized to fit, so a map that shrank gives its memory back. Returns 0 if the
+// new tree couldn't be allocated (the map is left as it was)
+int ezKeyMapCompact(ezKeyMap *map);
+// Builds a map from keys sorted in ascending order in one pass, the trie is laid
+// out depth first in a tree allocated to the exact size needed. If a key repeats
+// the last value wins, `values` can be NULL to store NULL for every key. Returns
+// NULL if the keys aren't sorted or the tree couldn't be allocated
+ezKeyMap* ezKeyMapBuild(const uint64_t *keys, void **values, size_t count);
+// Set operations on the keys of two maps, the result is a new map built densely
+// with `a`'s value for keys in both. Both maps are walked in order together and
+// whichever is behind seeks ahead, so for intersections and differences the
+// parts of `b` with no keys of `a` nearby are skipped rather than walked. Typed
+// maps must have the same value size. Return NULL if the result can't be built
+ezKeyMap* ezKeyMapUnion(ezKeyMap *a, ezKeyMap *b);
+ezKeyMap* ezKeyMapIntersect(ezKeyMap *a, ezKeyMap *b);
+// Keys in `a` that aren't in `b`
+ezKeyMap* ezKeyMapDifference(ezKeyMap *a, ezKeyMap *b);
+// Keys in either map but not both
+ezKeyMap* ezKeyMapSymmetricDifference(ezKeyMap *a, ezKeyMap *b);
+// Sizes of the results above without building them, each is one intersecting
+// walk as the others follow from the maps' counts
+size_t ezKeyMapIntersectCount(ezKeyMap *a, ezKeyMap *b);
+size_t ezKeyMapUnionCount(ezKeyMap *a, ezKeyMap *b);
+size_t ezKeyMapDifferenceCount(ezKeyMap *a, ezKeyMap *b);
+size_t ezKeyMapSymmetricDifferenceCount(ezKeyMap *a, ezKeyMap *b);
+// Puts a Bloom filter in front of the map so lookups of missing keys (Get,
+// GetMany, Del, ezKeySetHas) are mostly answered from one cache line instead of
+// a walk down the trie. Adds keep the filter up to date, deletes leave their
+// bits set until the filter is rebuilt from the trie, which happens when it
+// outgrows its capacity and on ezKeyMapCompact. Returns 0 if it couldn't be
+// allocated. Filters aren't saved by ezKeyMapSave
+int ezKeyMapAddFilter(ezKeyMap *map, double falsePositiveRate);
+void ezKeyMapRemoveFilter(ezKeyMap *map);
 void ezKeyMapDestroy(ezKeyMap *map);
 
+// Writes the tree to `path` as is, it holds offsets rather than pointers so it
+// can be loaded anywhere. Values are stored verbatim, so this only makes sense
+// for maps holding integers or offsets. The file is written to "<path>.tmp" and
+// renamed over `path`, processes still mapping the old file are unaffected
+int ezKeyMapSave(ezKeyMap *map, const char *path);
+// Maps a file written by ezKeyMapSave read-only, nothing is parsed or copied,
+// pages are loaded on demand as lookups touch them. Get, GetMany and Each work
+// as normal while Set and Del fail. Returns NULL if the file isn't a valid map
+ezKeyMap* ezKeyMapMap(const char *path);
+
+// Thread-safe map made up of ezKeyMap shards, keys are spread across shards by
+// a hash of the key. Writers lock a single shard with a sequence lock, readers
+// don't take locks and retry if a writer changed the shard while they walked it.
+// Trees replaced by growing a shard are freed once no reader can still be in them
+typedef struct ezKeyMapShard ezKeyMapShard;
+typedef struct ezKeyMapReaderSlot ezKeyMapReaderSlot;
+
+typedef struct {
+    ezKeyMapShard *shards;
+    ezKeyMapReaderSlot *readers;
+    size_t shardCount;
+    volatile long phase, reclaiming;
+} ezConcurrentKeyMap;
+
+// `shards` is rounded up to a power of two (0 for EZMAP_DEFAULT_SHARDS), a few
+// per core (ezProcessorCount() * 4) keeps writers from colliding. `capacity` is
+// a hint for the total number of keys
+ezConcurrentKeyMap* ezConcurrentKeyMapNew(size_t shards, size_t capacity);
+int ezConcurrentKeyMapSet(ezConcurrentKeyMap *map, uint64_t key, void *value);
+void* ezConcurrentKeyMapGet(ezConcurrentKeyMap *map, uint64_t key);
+void* ezConcurrentKeyMapDel(ezConcurrentKeyMap *map, uint64_t key);
+// Only approximate while other threads are writing
+size_t ezConcurrentKeyMapCount(ezConcurrentKeyMap *map);
+// Compacts each shard in turn, other threads can keep using the map
+void ezConcurrentKeyMapCompact(ezConcurrentKeyMap *map);
+// Not thread-safe, no other threads can be using the map
+void ezConcurrentKeyMapDestroy(ezConcurrentKeyMap *map);
+
+// Open addressing hash table for unordered workloads, a lookup is usually a
+// single probe of 16 control bytes (one SSE2 compare) and one slot. Keys and
+// values are stored inline, deleted keys are filled by shifting the keys after
+// them back so no tombstones build up. Keys aren't kept in any order
+typedef struct {
+    ezKeyValuePair *slots;
+    uint8_t *control;       // capacity + 16 bytes, the first 16 are repeated at the end
+    size_t count, capacity; // capacity is a power of two
+    size_t growth;          // keys that can be added before the table grows
+} ezFlatMap;
+
+ezFlatMap* ezFlatMapNew(size_t capacity);
+int ezFlatMapSet(ezFlatMap *map, uint64_t key, void *value);
+void* ezFlatMapGet(ezFlatMap *map, uint64_t key);
+void* ezFlatMapDel(ezFlatMap *map, uint64_t key);
+// Grows the table so `capacity` keys fit without rehashing, returns 0 on failure
+int ezFlatMapReserve(ezFlatMap *map, size_t capacity);
+int ezFlatMapEach(ezFlatMap *map, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata);
+void ezFlatMapDestroy(ezFlatMap *map);
+
+// Fixed size cache with the CLOCK policy: hits only set a bit on the entry, when
+// the cache is full a hand sweeps the entries clearing bits and evicts the first
+// entry whose bit was already clear. Entries live in one pool and are found
+// through an ezFlatMap, nothing is allocated after ezCacheNew
+typedef struct ezCacheEntry ezCacheEntry;
+
+typedef struct {
+    ezFlatMap *index; // key -> entry
+    ezCacheEntry *entries;
+    uint8_t *flags;
+    size_t capacity, count, hand, freed;
+    size_t hits, misses, evictions;
+    // Called for every value that leaves the cache other than by ezCacheDel,
+    // including values replaced by ezCachePut and those left at ezCacheDestroy
+    void(*evict)(uint64_t key, void *value, void *userdata);
+    void *userdata;
+} ezCache;
+
+ezCache* ezCacheNew(size_t capacity, void(*evict)(uint64_t key, void *value, void *userdata), void *userdata);
+// Counts as a hit or miss
+void* ezCacheGet(ezCache *cache, uint64_t key);
+// Same as ezCacheGet without touching the counters or the entry's bit
+void* ezCachePeek(ezCache *cache, uint64_t key);
+// Adds or replaces a value, evicting one entry if the cache is full. New
+// entries start unreferenced so one-off keys are the first to go
+int ezCachePut(ezCache *cache, uint64_t key, void *value);
+// Removes the key without calling `evict`, returns its value
+void* ezCacheDel(ezCache *cache, uint64_t key);
+void ezCacheClear(ezCache *cache);
+void ezCacheDestroy(ezCache *cache);
+
+// Ordered map from strings to values (an adaptive radix tree), full keys are
+// stored so keys can be listed in order or by prefix. Node size adapts to the
+// number of children and chains of single children are collapsed
+typedef struct {
+    void *root;
+    size_t count;
+} ezStringMap;
+
+ezStringMap* ezStringMapNew(void);
+int ezStringMapSet(ezStringMap *map, const char *key, void *value);
+void* ezStringMapGet(ezStringMap *map, const char *key);
+void* ezStringMapDel(ezStringMap *map, const char *key);
+// Calls `callback` for every key in byte order, stops early if `callback`
+// returns 0. Returns the number of keys visited
+size_t ezStringMapEach(ezStringMap *map, int(*callback)(const char *key, size_t length, void *value, void *userdata), void *userdata);
+// Same as ezStringMapEach for the keys starting with `prefix`, only the subtree
+// under the prefix is walked
+size_t ezStringMapPrefix(ezStringMap *map, const char *prefix, int(*callback)(const char *key, size_t length, void *value, void *userdata), void *userdata);
+// Finds the longest key that `key` starts with (routing table style lookups),
+// returns its value and stores its length in `matched` (if not NULL). Returns
+// NULL if no key matches
+void* ezStringMapLongestPrefix(ezStringMap *map, const char *key, size_t *matched);
+void ezStringMapDestroy(ezStringMap *map);
+
+// Dictionaries are key maps from a hash of the string to the interned key, keys
+// are copied into an arena owned by the map and compared on lookup, so keys
+// whose hashes collide are chained rather than overwriting each other. Don't
+// mix string and integer keys in the same map
 typedef ezKeyMap ezDictionary;
 typedef ezKeyMap ezDict;
 
@@ -70,35 +356,76 @@ typedef ezKeyMap ezDict;
 int ezDictSet(ezDict *dict, const char *key, void *value);
 void* ezDictGet(ezDict *dict, const char *key);
 void* ezDictDel(ezDict *dict, const char *key);
-#define ezDictEach(...) ezKeyMapIter(__VA_ARGS__)
+// The hash the dictionary functions use (ezHash with the dictionary's seed),
+// `key` doesn't need to be terminated
+uint64_t ezDictHash(ezDict *dict, const void *key, size_t length);
+// Dictionaries hash with EZMAP_HASH_SEED unless given a seed, a random seed
+// stops anyone picking keys that collide on purpose. Returns 0 if the dictionary
+// already has keys, their hashes would no longer match
+int ezDictSeed(ezDict *dict, uint64_t seed);
+// Same as above for callers that keep the length and ezDictHash of their keys
+// around, nothing is hashed or measured. Keys can contain NULs
+int ezDictSetHashed(ezDict *dict, const void *key, size_t length, uint64_t hash, void *value);
+void* ezDictGetHashed(ezDict *dict, const void *key, size_t length, uint64_t hash);
+void* ezDictDelHashed(ezDict *dict, const void *key, size_t length, uint64_t hash);
+// Number of keys, the map's `count` is the number of distinct hashes
+size_t ezDictCount(ezDict *dict);
+// Calls `callback` for every key (in hash order, keys passed are terminated),
+// stops early if `callback` returns 0. Returns the number of keys visited
+size_t ezDictEach(ezDict *dict, int(*callback)(const char *key, size_t length, void *value, void *userdata), void *userdata);
 #define ezDictDestroy(...) ezKeyMapDestroy(__VA_ARGS__)
 
+// ezDict hashes keys with wyhash, define EZMAP_USE_XXH3 or EZMAP_USE_MURMUR to
+// use XXH3 or MurmurHash3 instead. ezHash is whichever was chosen
+uint64_t ezHash(const void *data, size_t length, uint64_t seed);
+uint64_t ezHashWy(const void *data, size_t length, uint64_t seed);
+uint64_t ezHashXXH3(const void *data, size_t length, uint64_t seed);
 uint64_t MurmurHash(const void *data, size_t len, uint32_t seed);
 
 #if !defined(EZMAP_DISABLE_GENERICS)
+// The engine is picked by the map passed in, an ezMap (ezKeyMap) is a trie, an
+// ezFlatMap is a hash table and an ezStringMap is a radix tree. Flat maps only
+// take integer keys and string maps only take strings
 typedef ezKeyMap ezMap;
 
 #define ezMapNew(...) ezKeyMapNew(__VA_ARGS__)
-#define ezMapSet(Hash, KEY, VAL) _Generic((KEY),                \
-                                         int: ezKeyMapSet,      \
-                                         uint64_t: ezKeyMapSet, \
-                                         char*: ezDictSet,      \
-                                         const char*: ezDictSet \
+#define ezMapSet(Hash, KEY, VAL) _Generic((Hash),                     \
+                                         ezFlatMap*: ezFlatMapSet,     \
+                                         ezStringMap*: ezStringMapSet, \
+                                         default: _Generic((KEY),      \
+                                            int: ezKeyMapSet,          \
+                                            uint64_t: ezKeyMapSet,     \
+                                            char*: ezDictSet,          \
+                                            const char*: ezDictSet)    \
                                         )(Hash, KEY, VAL)
-#define ezMapGet(Hash, KEY) _Generic((KEY),                     \
-                                    int: ezKeyMapGet,           \
-                                    uint64_t: ezKeyMapGet,      \
-                                    char*: ezDictGet,           \
-                                    const char*: ezDictGet      \
+#define ezMapGet(Hash, KEY) _Generic((Hash),                          \
+                                    ezFlatMap*: ezFlatMapGet,          \
+                                    ezStringMap*: ezStringMapGet,      \
+                                    default: _Generic((KEY),           \
+                                       int: ezKeyMapGet,               \
+                                       uint64_t: ezKeyMapGet,          \
+                                       char*: ezDictGet,               \
+                                       const char*: ezDictGet)         \
                                    )(Hash, KEY)
-#define ezMapDel(Hash, KEY) _Generic((KEY),                     \
-                                    int: ezKeyMapDel,           \
-                                    uint64_t: ezKeyMapDel,      \
-                                    char*: ezDictDel,           \
-                                    const char*: ezDictDel      \
+#define ezMapDel(Hash, KEY) _Generic((Hash),                          \
+                                    ezFlatMap*: ezFlatMapDel,          \
+                                    ezStringMap*: ezStringMapDel,      \
+                                    default: _Generic((KEY),           \
+                                       int: ezKeyMapDel,               \
+                                       uint64_t: ezKeyMapDel,          \
+                                       char*: ezDictDel,               \
+                                       const char*: ezDictDel)         \
                                    )(Hash, KEY)
-#define ezMapEach(...) ezKeyMapEach(__VA_ARGS__)
-#define ezMapDestroy(...) ezKeyMapDestroy(__VA_ARGS__)
+#define ezMapEach(Hash, ...) _Generic((Hash),                         \
+                                     ezFlatMap*: ezFlatMapEach,        \
+                                     ezStringMap*: ezStringMapEach,    \
+                                     default: ezKeyMapEach             \
+                                    )(Hash, __VA_ARGS__)
+#define ezMapDestroy(Hash) _Generic((Hash),                           \
+                                   ezFlatMap*: ezFlatMapDestroy,       \
+                                   ezStringMap*: ezStringMapDestroy,   \
+                                   default: ezKeyMapDestroy            \
+                                  )(Hash)
 #endif
 
 #if defined(__cplusplus)
@@ -108,13 +435,53 @@ typedef ezKeyMap ezMap;
 
 #if defined(EZMAP_IMPLEMENTATION) || defined(EZ_IMPLEMENTATION)
 #include <assert.h>
+#include <stdio.h>
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#else
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+// Node prefix + popcount helpers use SSE4.1/AVX2 (and BMI2 if available) when
+// enabled at compile time, XXH3 uses SSE2/AVX2. Define EZMAP_DISABLE_SIMD to
+// use the portable versions
+#if !defined(EZMAP_DISABLE_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define EZMAP_SSE2
+#if defined(__AVX2__)
+#define EZMAP_AVX2
+#endif
+#if defined(__SSE4_1__) || defined(EZMAP_AVX2)
+#define EZMAP_SSE41
+#endif
+#if defined(__BMI2__)
+#define EZMAP_BMI2
+#endif
+#include <immintrin.h>
+#endif
 
 #ifndef IMAP_IMPLEMENTATION
 #define IMAP_IMPLEMENTATION
+// Slots hold a 4 bit prefix nibble, flags and the offset of a node or boxed
+// value. With 32-bit slots a tree is limited to 512MB, EZMAP_LARGE widens them
+// to 64 bits so nodes are 128 bytes and there is no practical limit
+#if defined(EZMAP_LARGE)
+#if UINTPTR_MAX <= 0xffffffffu
+#error "EZMAP_LARGE requires a 64-bit target"
+#endif
+typedef uint64_t imap_slot_t;
+#define IMAP_MAX_SIZE               (1ull << 48)
+#else
+typedef uint32_t imap_slot_t;
+#define IMAP_MAX_SIZE               0x20000000
+#endif
+
 struct imap_node_t {
     union {
-        uint32_t vec32[16];
-        uint64_t vec64[8];
+        imap_slot_t vec[16];
+        uint64_t vec64[sizeof(imap_slot_t) * 2];
     };
 };
 
@@ -128,18 +495,20 @@ struct imap_node_t {
 #define imap__slot_pmask__          0x0000000f
 #define imap__slot_node__           0x00000010
 #define imap__slot_scalar__         0x00000020
-#define imap__slot_value__          0xffffffe0
+#define imap__slot_value__          (~(imap_slot_t)0x1f)
 #define imap__slot_shift__          6
+#define imap__node_vals__           (sizeof(imap_node_t) / sizeof(uint64_t))
+#define imap__tree_cell__           ((imap__tree_vfre__ + 1) * sizeof(imap_slot_t) / sizeof(uint64_t))
 #define imap__slot_boxed__(sval)    (!((sval) & imap__slot_scalar__) && ((sval) >> imap__slot_shift__))
 
 typedef struct {
-    uint32_t stack[16];
+    imap_slot_t stack[16];
     uint32_t stackp;
 } imap_iter_t;
 
 typedef struct {
     uint64_t x;
-    uint32_t *slot;
+    imap_slot_t *slot;
 } imap_pair_t;
 
 #define imap__pair_zero__           ((imap_pair_t){0})
@@ -181,14 +550,98 @@ static inline void imap__aligned_free__(void *p) {
 #define IMAP_ALIGNED_ALLOC(a, s)    (imap__aligned_alloc__(a, s))
 #define IMAP_ALIGNED_FREE(p)        (imap__aligned_free__(p))
 
-static inline imap_node_t* imap__node__(imap_node_t *tree, uint32_t val) {
+#if defined(EZMAP_LARGE)
+#if !defined(_WIN32) && !defined(_WIN64) && !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+// Large trees reserve address space and commit pages as they grow, so growing
+// doesn't copy the tree (or move it) until it outgrows the reservation. The
+// size of the reservation is kept in the tree's otherwise unused resv field
+static imap_node_t* imap__tree_alloc__(uint64_t reserve, uint64_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    void *p = VirtualAlloc(NULL, reserve, MEM_RESERVE, PAGE_NOACCESS);
+    if (p && !VirtualAlloc(p, size, MEM_COMMIT, PAGE_READWRITE)) {
+        VirtualFree(p, 0, MEM_RELEASE);
+        p = NULL;
+    }
+#else
+    int flags = MAP_PRIVATE;
+#if defined(MAP_NORESERVE)
+    flags |= MAP_NORESERVE;
+#endif
+#if defined(MAP_ANONYMOUS)
+    void *p = mmap(NULL, reserve, PROT_NONE, flags | MAP_ANONYMOUS, -1, 0);
+#else
+    // Without MAP_ANONYMOUS (strict ISO modes hide it when a system header came
+    // before ezmap.h) a private mapping of /dev/zero is the POSIX equivalent
+    int fd = open("/dev/zero", O_RDWR);
+    if (fd < 0)
+        return NULL;
+    void *p = mmap(NULL, reserve, PROT_NONE, flags, fd, 0);
+    close(fd);
+#endif
+    if (p == MAP_FAILED)
+        return NULL;
+    if (mprotect(p, size, PROT_READ | PROT_WRITE)) {
+        munmap(p, reserve);
+        p = NULL;
+    }
+#endif
+    return (imap_node_t*)p;
+}
+
+static int imap__tree_commit__(imap_node_t *tree, uint64_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    return !!VirtualAlloc(tree, size, MEM_COMMIT, PAGE_READWRITE);
+#else
+    return !mprotect(tree, size, PROT_READ | PROT_WRITE);
+#endif
+}
+
+static void imap__tree_free__(imap_node_t *tree) {
+    if (!tree)
+        return;
+#if defined(_WIN32) || defined(_WIN64)
+    VirtualFree(tree, 0, MEM_RELEASE);
+#else
+    munmap(tree, tree->vec[imap__tree_resv__]);
+#endif
+}
+#else
+#define imap__tree_free__(t)        (IMAP_ALIGNED_FREE(t))
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define imap__prefetch__(p)         (_mm_prefetch((const char*)(p), _MM_HINT_T0))
+#elif defined(__GNUC__) || defined(__clang__)
+#define imap__prefetch__(p)         (__builtin_prefetch((p)))
+#else
+#define imap__prefetch__(p)         ((void)(p))
+#endif
+
+static inline imap_node_t* imap__node__(imap_node_t *tree, imap_slot_t val) {
     return (imap_node_t*)((uint8_t*)tree + val);
 }
 
 static inline uint32_t imap__node_pos__(imap_node_t *node) {
-    return node->vec32[0] & 0xf;
+    return node->vec[0] & 0xf;
+}
+
+#if defined(EZMAP_LARGE)
+// Slot i holds the nibble at bit 4i of the prefix
+static inline uint64_t imap__extract_lo4_port__(imap_slot_t vec[16]) {
+    uint64_t prefix = 0;
+    for (uint32_t i = 0; i < 16; i++)
+        prefix |= (vec[i] & 0xf) << (i << 2);
+    return prefix;
 }
 
+static inline void imap__deposit_lo4_port__(imap_slot_t vec[16], uint64_t value) {
+    for (uint32_t i = 0; i < 16; i++)
+        vec[i] = (vec[i] & ~0xfull) | ((value >> (i << 2)) & 0xf);
+}
+#else
 static inline uint64_t imap__extract_lo4_port__(uint32_t vec32[16]) {
     union {
         uint32_t *vec32;
@@ -221,25 +674,19 @@ static inline void imap__deposit_lo4_port__(uint32_t vec32[16], uint64_t value)
     u.vec64[6] = (u.vec64[6] & ~0xf0000000full) | ((value >> 24) & 0xf0000000full);
     u.vec64[7] = (u.vec64[7] & ~0xf0000000full) | ((value >> 28) & 0xf0000000full);
 }
-
-static inline void imap__node_setprefix__(imap_node_t *node, uint64_t prefix) {
-    imap__deposit_lo4_port__(node->vec32, prefix);
-}
-
-static inline uint64_t imap__node_prefix__(imap_node_t *node) {
-    return imap__extract_lo4_port__(node->vec32);
-}
+#endif
 
 static inline uint32_t imap__xdir__(uint64_t x, uint32_t pos) {
     return (x >> (pos << 2)) & 0xf;
 }
 
-static inline uint32_t imap__popcnt_hi28_port__(uint32_t vec32[16], uint32_t *p) {
-    uint32_t pcnt = 0, sval, dirn;
+static inline uint32_t imap__popcnt_hi28_port__(imap_slot_t vec[16], imap_slot_t *p) {
+    imap_slot_t sval;
+    uint32_t pcnt = 0, dirn;
     *p = 0;
     for (dirn = 0; 16 > dirn; dirn++)
     {
-        sval = vec32[dirn];
+        sval = vec[dirn];
         if (sval & ~0xf)
         {
             *p = sval;
@@ -249,100 +696,250 @@ static inline uint32_t imap__popcnt_hi28_port__(uint32_t vec32[16], uint32_t *p)
     return pcnt;
 }
 
-static inline uint32_t imap__node_popcnt__(imap_node_t *node, uint32_t *p) {
-    return imap__popcnt_hi28_port__(node->vec32, p);
+#if defined(EZMAP_SSE41) && !defined(EZMAP_LARGE)
+// Byte i of a 64-bit word holds nibble i, 8 nibbles packed into 32 bits and back
+static inline uint32_t imap__pack_nibbles__(uint64_t x) {
+#if defined(EZMAP_BMI2)
+    return (uint32_t)_pext_u64(x, 0x0f0f0f0f0f0f0f0full);
+#else
+    x = (x | (x >> 4)) & 0x00ff00ff00ff00ffull;
+    x = (x | (x >> 8)) & 0x0000ffff0000ffffull;
+    return (uint32_t)(x | (x >> 16));
+#endif
+}
+
+static inline uint64_t imap__unpack_nibbles__(uint32_t v) {
+#if defined(EZMAP_BMI2)
+    return _pdep_u64(v, 0x0f0f0f0f0f0f0f0full);
+#else
+    uint64_t x = v;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+    return (x | (x << 4)) & 0x0f0f0f0f0f0f0f0full;
+#endif
+}
+
+// The prefix stores the nibble of slot 2k at bit 4k and slot 2k+1 at bit 32+4k,
+// so the slot nibbles are narrowed to bytes then split into even and odd halves
+static inline uint64_t imap__extract_lo4_simd__(uint32_t vec[16]) {
+    const __m128i lo4 = _mm_set1_epi32(0xf);
+    const __m128i *v = (const __m128i*)vec;
+    __m128i a = _mm_packus_epi32(_mm_and_si128(_mm_loadu_si128(v), lo4), _mm_and_si128(_mm_loadu_si128(v + 1), lo4));
+    __m128i b = _mm_packus_epi32(_mm_and_si128(_mm_loadu_si128(v + 2), lo4), _mm_and_si128(_mm_loadu_si128(v + 3), lo4));
+    __m128i n = _mm_shuffle_epi8(_mm_packus_epi16(a, b), _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+    return imap__pack_nibbles__((uint64_t)_mm_cvtsi128_si64(n)) |
+           (uint64_t)imap__pack_nibbles__((uint64_t)_mm_extract_epi64(n, 1)) << 32;
+}
+
+static inline void imap__deposit_lo4_simd__(uint32_t vec[16], uint64_t value) {
+    __m128i n = _mm_set_epi64x((long long)imap__unpack_nibbles__((uint32_t)(value >> 32)),
+                               (long long)imap__unpack_nibbles__((uint32_t)value));
+    n = _mm_shuffle_epi8(n, _mm_setr_epi8(0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15));
+#if defined(EZMAP_AVX2)
+    const __m256i hi28 = _mm256_set1_epi32(~0xf);
+    __m256i *v = (__m256i*)vec;
+    _mm256_storeu_si256(v, _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(v), hi28), _mm256_cvtepu8_epi32(n)));
+    _mm256_storeu_si256(v + 1, _mm256_or_si256(_mm256_and_si256(_mm256_loadu_si256(v + 1), hi28), _mm256_cvtepu8_epi32(_mm_srli_si128(n, 8))));
+#else
+    const __m128i hi28 = _mm_set1_epi32(~0xf);
+    __m128i *v = (__m128i*)vec;
+    _mm_storeu_si128(v, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(v), hi28), _mm_cvtepu8_epi32(n)));
+    _mm_storeu_si128(v + 1, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(v + 1), hi28), _mm_cvtepu8_epi32(_mm_srli_si128(n, 4))));
+    _mm_storeu_si128(v + 2, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(v + 2), hi28), _mm_cvtepu8_epi32(_mm_srli_si128(n, 8))));
+    _mm_storeu_si128(v + 3, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(v + 3), hi28), _mm_cvtepu8_epi32(_mm_srli_si128(n, 12))));
+#endif
+}
+
+// Compares all 16 slots at once, *p is set to the last occupied slot like the portable version
+static inline uint32_t imap__popcnt_hi28_simd__(uint32_t vec[16], imap_slot_t *p) {
+    uint32_t mask;
+#if defined(EZMAP_AVX2)
+    const __m256i hi28 = _mm256_set1_epi32(~0xf), zero = _mm256_setzero_si256();
+    const __m256i *v = (const __m256i*)vec;
+    mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(v), hi28), zero))) |
+           (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_loadu_si256(v + 1), hi28), zero))) << 8;
+#else
+    const __m128i hi28 = _mm_set1_epi32(~0xf), zero = _mm_setzero_si128();
+    const __m128i *v = (const __m128i*)vec;
+    mask = 0;
+    for (int i = 0; i < 4; i++)
+        mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(_mm_loadu_si128(v + i), hi28), zero))) << (i * 4);
+#endif
+    mask = ~mask & 0xffff;
+    *p = mask ? vec[imap__bsr__(mask)] : 0;
+#if defined(_MSC_VER)
+    return __popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+#define imap__extract_lo4__ imap__extract_lo4_simd__
+#define imap__deposit_lo4__ imap__deposit_lo4_simd__
+#define imap__popcnt_hi28__ imap__popcnt_hi28_simd__
+#else
+#define imap__extract_lo4__ imap__extract_lo4_port__
+#define imap__deposit_lo4__ imap__deposit_lo4_port__
+#define imap__popcnt_hi28__ imap__popcnt_hi28_port__
+#endif
+
+static inline void imap__node_setprefix__(imap_node_t *node, uint64_t prefix) {
+    imap__deposit_lo4__(node->vec, prefix);
+}
+
+static inline uint64_t imap__node_prefix__(imap_node_t *node) {
+    return imap__extract_lo4__(node->vec);
+}
+
+static inline uint32_t imap__node_popcnt__(imap_node_t *node, imap_slot_t *p) {
+    return imap__popcnt_hi28__(node->vec, p);
 }
 
-static inline uint32_t imap__alloc_node__(imap_node_t *tree) {
-    uint32_t mark = tree->vec32[imap__tree_nfre__];
+static inline imap_slot_t imap__alloc_node__(imap_node_t *tree) {
+    imap_slot_t mark = tree->vec[imap__tree_nfre__];
     if (mark)
-        tree->vec32[imap__tree_nfre__] = *(uint32_t*)((uint8_t *)tree + mark);
+        tree->vec[imap__tree_nfre__] = *(imap_slot_t*)((uint8_t *)tree + mark);
     else {
-        mark = tree->vec32[imap__tree_mark__];
-        assert(mark + sizeof(imap_node_t) <= tree->vec32[imap__tree_size__]);
-        tree->vec32[imap__tree_mark__] = mark + sizeof(imap_node_t);
+        mark = tree->vec[imap__tree_mark__];
+        assert(mark + sizeof(imap_node_t) <= tree->vec[imap__tree_size__]);
+        tree->vec[imap__tree_mark__] = mark + sizeof(imap_node_t);
     }
     return mark;
 }
 
-static inline void imap__free_node__(imap_node_t *tree, uint32_t mark) {
-    *(uint32_t *)((uint8_t *)tree + mark) = tree->vec32[imap__tree_nfre__];
-    tree->vec32[imap__tree_nfre__] = mark;
+static inline void imap__free_node__(imap_node_t *tree, imap_slot_t mark) {
+    *(imap_slot_t*)((uint8_t *)tree + mark) = tree->vec[imap__tree_nfre__];
+    tree->vec[imap__tree_nfre__] = mark;
 }
 
 static inline uint64_t imap__xpfx__(uint64_t x, uint32_t pos) {
     return x & (~0xfull << (pos << 2));
 }
 
-static imap_node_t* imap_ensure(imap_node_t *tree, size_t capacity) {
+// Allocates an empty tree of `size` bytes. `valsize` is the size of the boxed
+// values it will hold, the header node's spare room is only used for value cells
+static imap_node_t* imap_create(uint64_t size, uint32_t valsize) {
+    if (IMAP_MAX_SIZE < size)
+        return NULL;
+#if defined(EZMAP_LARGE)
+    uint64_t reserve = size * EZMAP_LARGE_GROWTH < IMAP_MAX_SIZE ? size * EZMAP_LARGE_GROWTH : IMAP_MAX_SIZE;
+    imap_node_t *tree = imap__tree_alloc__(reserve, size);
+#else
+    imap_node_t *tree = (imap_node_t*)IMAP_ALIGNED_ALLOC(sizeof(imap_node_t), size);
+#endif
+    if (!tree)
+        return tree;
+    tree->vec[imap__tree_root__] = 0;
+#if defined(EZMAP_LARGE)
+    tree->vec[imap__tree_resv__] = reserve;
+#else
+    tree->vec[imap__tree_resv__] = 0;
+#endif
+    tree->vec[imap__tree_mark__] = sizeof(imap_node_t);
+    tree->vec[imap__tree_size__] = size;
+    tree->vec[imap__tree_nfre__] = 0;
+    tree->vec[imap__tree_vfre__] = 0;
+    if (valsize != sizeof(uint64_t))
+        return tree;
+    // The rest of the header node is a free list of value cells
+    uint32_t cell = imap__tree_cell__;
+    tree->vec[imap__tree_vfre__] = cell << imap__slot_shift__;
+    for (; cell < imap__node_vals__ - 1; cell++)
+        tree->vec64[cell] = (cell + 1) << imap__slot_shift__;
+    tree->vec64[cell] = 0;
+    return tree;
+}
+
+// Returns a copy of `tree` with room for `capacity` more keys with boxed values
+// of `valsize` bytes, or `tree` itself if it is already big enough (or, for
+// large trees, could grow in place). The old tree is left for the caller to free
+static imap_node_t* imap_grow(imap_node_t *tree, size_t capacity, uint32_t valsize) {
     if (!capacity)
         return NULL;
     imap_node_t *newtree;
-    uint32_t hasnfre, hasvfre, newmark, oldsize, newsize;
-    uint64_t newsize64;
+    uint32_t hasnfre, hasvfre, pernode = sizeof(imap_node_t) / valsize;
+    uint64_t newmark, oldsize, newsize;
     if (!tree) {
         hasnfre = 0;
-        hasvfre = 1;
+        hasvfre = valsize == sizeof(uint64_t);
         newmark = sizeof(imap_node_t);
         oldsize = 0;
     } else {
-        hasnfre = !!tree->vec32[imap__tree_nfre__];
-        hasvfre = !!tree->vec32[imap__tree_vfre__];
-        newmark = tree->vec32[imap__tree_mark__];
-        oldsize = tree->vec32[imap__tree_size__];
+        hasnfre = !!tree->vec[imap__tree_nfre__];
+        hasvfre = !!tree->vec[imap__tree_vfre__];
+        newmark = tree->vec[imap__tree_mark__];
+        oldsize = tree->vec[imap__tree_size__];
     }
-    newmark += (capacity * 2 - hasnfre) * sizeof(imap_node_t) + (capacity - hasvfre) * sizeof(uint64_t);
+    newmark += (capacity * 2 - hasnfre) * sizeof(imap_node_t) + (capacity - hasvfre + pernode - 1) / pernode * sizeof(imap_node_t);
     if (newmark <= oldsize)
         return tree;
-    newsize64 = imap__ceilpow2__(newmark);
-    if (0x20000000 < newsize64)
-        return NULL;
-    newsize = (uint32_t)newsize64;
-    newtree = (imap_node_t*)IMAP_ALIGNED_ALLOC(sizeof(imap_node_t), newsize);
-    if (!newtree)
-        return newtree;
-    if (tree) {
-        memcpy(newtree, tree, tree->vec32[imap__tree_mark__]);
-        IMAP_ALIGNED_FREE(tree);
-        newtree->vec32[imap__tree_size__] = newsize;
-    } else {
-        newtree->vec32[imap__tree_root__] = 0;
-        newtree->vec32[imap__tree_resv__] = 0;
-        newtree->vec32[imap__tree_mark__] = sizeof(imap_node_t);
-        newtree->vec32[imap__tree_size__] = newsize;
-        newtree->vec32[imap__tree_nfre__] = 0;
-        newtree->vec32[imap__tree_vfre__] = 3 << imap__slot_shift__;
-        newtree->vec64[3] = 4 << imap__slot_shift__;
-        newtree->vec64[4] = 5 << imap__slot_shift__;
-        newtree->vec64[5] = 6 << imap__slot_shift__;
-        newtree->vec64[6] = 7 << imap__slot_shift__;
-        newtree->vec64[7] = 0;
+    newsize = imap__ceilpow2__(newmark);
+#if defined(EZMAP_LARGE)
+    if (tree && newsize <= tree->vec[imap__tree_resv__]) {
+        if (!imap__tree_commit__(tree, newsize))
+            return NULL;
+        tree->vec[imap__tree_size__] = newsize;
+        return tree;
     }
+#endif
+    if (!(newtree = imap_create(newsize, valsize)) || !tree)
+        return newtree;
+    imap_slot_t resv = newtree->vec[imap__tree_resv__];
+    memcpy(newtree, tree, tree->vec[imap__tree_mark__]);
+    newtree->vec[imap__tree_resv__] = resv;
+    newtree->vec[imap__tree_size__] = newsize;
     return newtree;
 }
 
-static uint32_t* imap_find(ezKeyMap *map, uint64_t x, int ensure) {
-    uint32_t *slotstack[16 + 1];
+static imap_node_t* imap_ensure(imap_node_t *tree, size_t capacity) {
+    imap_node_t *newtree = imap_grow(tree, capacity, sizeof(uint64_t));
+    if (newtree && tree && newtree != tree)
+        imap__tree_free__(tree);
+    return newtree;
+}
+
+static imap_slot_t* imap_lookup(imap_node_t *tree, uint64_t x) {
+    imap_node_t *node = tree;
+    imap_slot_t *slot;
+    imap_slot_t sval;
+    uint32_t posn = 16, dirn = 0;
+    for (;;) {
+        slot = &node->vec[dirn];
+        sval = *slot;
+        if (!(sval & imap__slot_node__)) {
+            if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull)) {
+                assert(0 == posn);
+                return slot;
+            }
+            return NULL;
+        }
+        node = imap__node__(tree, sval & imap__slot_value__);
+        posn = imap__node_pos__(node);
+        dirn = imap__xdir__(x, posn);
+    }
+}
+
+// The tree must have room for one more key (imap_ensure) before calling this,
+// growing it here would leave the walk pointing into the old allocation
+static imap_slot_t* imap_assign(imap_node_t *tree, uint64_t x) {
+    imap_slot_t *slotstack[16 + 1];
     uint32_t posnstack[16 + 1];
     uint32_t stackp, stacki;
-    imap_node_t *newnode, *node = map->tree;
-    uint32_t *slot;
-    uint32_t newmark, sval, diff, posn = 16, dirn = 0;
+    imap_node_t *newnode, *node = tree;
+    imap_slot_t *slot;
+    imap_slot_t newmark, sval;
+    uint32_t diff, posn = 16, dirn = 0;
     uint64_t prfx;
     stackp = 0;
     for (;;) {
-        slot = &node->vec32[dirn];
+        slot = &node->vec[dirn];
         sval = *slot;
         slotstack[stackp] = slot;
         posnstack[stackp++] = posn;
         if (!(sval & imap__slot_node__)) {
             prfx = imap__node_prefix__(node);
-            if (!ensure || (!posn && prfx == (x & ~0xfull)))
+            if (!posn && prfx == (x & ~0xfull))
                 return slot;
-            if (++map->count > map->capacity) {
-                map->capacity *= 2;
-                map->tree = imap_ensure(map->tree, map->capacity);
-            }
             diff = imap__xpos__(prfx ^ x);
             assert(diff < 16);
             for (stacki = stackp; diff > posn;)
@@ -351,54 +948,50 @@ static uint32_t* imap_find(ezKeyMap *map, uint64_t x, int ensure) {
                 slot = slotstack[stacki];
                 sval = *slot;
                 assert(sval & imap__slot_node__);
-                newmark = imap__alloc_node__(map->tree);
+                newmark = imap__alloc_node__(tree);
                 *slot = (*slot & imap__slot_pmask__) | imap__slot_node__ | newmark;
-                newnode = imap__node__(map->tree, newmark);
+                newnode = imap__node__(tree, newmark);
                 *newnode = imap__node_zero__;
-                newmark = imap__alloc_node__(map->tree);
-                newnode->vec32[imap__xdir__(prfx, diff)] = sval;
-                newnode->vec32[imap__xdir__(x, diff)] = imap__slot_node__ | newmark;
+                newmark = imap__alloc_node__(tree);
+                newnode->vec[imap__xdir__(prfx, diff)] = sval;
+                newnode->vec[imap__xdir__(x, diff)] = imap__slot_node__ | newmark;
                 imap__node_setprefix__(newnode, imap__xpfx__(prfx, diff) | diff);
             } else {
-                newmark = imap__alloc_node__(map->tree);
+                newmark = imap__alloc_node__(tree);
                 *slot = (*slot & imap__slot_pmask__) | imap__slot_node__ | newmark;
             }
-            newnode = imap__node__(map->tree, newmark);
+            newnode = imap__node__(tree, newmark);
             *newnode = imap__node_zero__;
             imap__node_setprefix__(newnode, x & ~0xfull);
-            return &newnode->vec32[x & 0xfull];
+            return &newnode->vec[x & 0xfull];
         }
-        node = imap__node__(map->tree, sval & imap__slot_value__);
+        node = imap__node__(tree, sval & imap__slot_value__);
         posn = imap__node_pos__(node);
         dirn = imap__xdir__(x, posn);
     }
 }
 
-static inline uint32_t imap__alloc_val__(imap_node_t *tree) {
-    uint32_t mark = imap__alloc_node__(tree);
-    imap_node_t *node = imap__node__(tree, mark);
+// Splits a new node into values of `valsize` bytes (a multiple of 8, value
+// cells are 8) and puts them on the free list
+static inline imap_slot_t imap__alloc_val__(imap_node_t *tree, uint32_t valsize) {
+    imap_slot_t mark = imap__alloc_node__(tree);
+    uint32_t cells = valsize >> 3, count = sizeof(imap_node_t) / valsize;
     mark <<= 3;
-    tree->vec32[imap__tree_vfre__] = mark;
-    node->vec64[0] = mark + (1 << imap__slot_shift__);
-    node->vec64[1] = mark + (2 << imap__slot_shift__);
-    node->vec64[2] = mark + (3 << imap__slot_shift__);
-    node->vec64[3] = mark + (4 << imap__slot_shift__);
-    node->vec64[4] = mark + (5 << imap__slot_shift__);
-    node->vec64[5] = mark + (6 << imap__slot_shift__);
-    node->vec64[6] = mark + (7 << imap__slot_shift__);
-    node->vec64[7] = 0;
+    tree->vec[imap__tree_vfre__] = mark;
+    for (uint32_t i = 0; i < count; i++)
+        tree->vec64[(mark >> imap__slot_shift__) + i * cells] = i + 1 < count ? mark + ((uint64_t)(i + 1) * cells << imap__slot_shift__) : 0;
     return mark;
 }
 
-static void imap_setval64(imap_node_t *tree, uint32_t *slot, uint64_t y) {
+static void imap_setval64(imap_node_t *tree, imap_slot_t *slot, uint64_t y) {
     assert(!(*slot & imap__slot_node__));
-    uint32_t sval = *slot;
+    imap_slot_t sval = *slot;
     if (!(sval >> imap__slot_shift__)) {
-        sval = tree->vec32[imap__tree_vfre__];
+        sval = tree->vec[imap__tree_vfre__];
         if (!sval)
-            sval = imap__alloc_val__(tree);
+            sval = imap__alloc_val__(tree, sizeof(uint64_t));
         assert(sval >> imap__slot_shift__);
-        tree->vec32[imap__tree_vfre__] = (uint32_t)tree->vec64[sval >> imap__slot_shift__];
+        tree->vec[imap__tree_vfre__] = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__];
     }
     assert(!(sval & imap__slot_node__));
     assert(imap__slot_boxed__(sval));
@@ -406,34 +999,64 @@ static void imap_setval64(imap_node_t *tree, uint32_t *slot, uint64_t y) {
     tree->vec64[sval >> imap__slot_shift__] = y;
 }
 
-static uint64_t imap_getval(imap_node_t *tree, uint32_t *slot) {
+static uint64_t imap_getval(imap_node_t *tree, imap_slot_t *slot) {
     assert(!(*slot & imap__slot_node__));
-    uint32_t sval = *slot;
+    imap_slot_t sval = *slot;
     if (!imap__slot_boxed__(sval))
         return sval >> imap__slot_shift__;
     else
         return tree->vec64[sval >> imap__slot_shift__];
 }
 
-static void imap_delval(imap_node_t *tree, uint32_t *slot) {
+static void imap_delval(imap_node_t *tree, imap_slot_t *slot) {
     assert(!(*slot & imap__slot_node__));
-    uint32_t sval = *slot;
+    imap_slot_t sval = *slot;
     if (imap__slot_boxed__(sval)) {
-        tree->vec64[sval >> imap__slot_shift__] = tree->vec32[imap__tree_vfre__];
-        tree->vec32[imap__tree_vfre__] = sval & imap__slot_value__;
+        tree->vec64[sval >> imap__slot_shift__] = tree->vec[imap__tree_vfre__];
+        tree->vec[imap__tree_vfre__] = sval & imap__slot_value__;
     }
     *slot &= imap__slot_pmask__;
 }
 
+// Values small enough are kept in the slot itself (a scalar), anything else
+// is boxed in a value cell
+static void imap_setval(imap_node_t *tree, imap_slot_t *slot, uint64_t y) {
+    assert(!(*slot & imap__slot_node__));
+    if (y <= imap__slot_value__ >> imap__slot_shift__) {
+        imap_delval(tree, slot);
+        *slot |= imap__slot_scalar__ | (imap_slot_t)(y << imap__slot_shift__);
+    } else {
+        if (*slot & imap__slot_scalar__)
+            *slot &= imap__slot_pmask__;
+        imap_setval64(tree, slot, y);
+    }
+}
+
+// Returns the slot's block of `valsize` bytes, allocating one if it has none.
+// Blocks share the free list with value cells, so a tree holds one or the other
+static void* imap_setblock(imap_node_t *tree, imap_slot_t *slot, uint32_t valsize) {
+    assert(!(*slot & imap__slot_node__));
+    imap_slot_t sval = *slot;
+    if (!imap__slot_boxed__(sval)) {
+        sval = tree->vec[imap__tree_vfre__];
+        if (!sval)
+            sval = imap__alloc_val__(tree, valsize);
+        tree->vec[imap__tree_vfre__] = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__];
+        *slot = (*slot & imap__slot_pmask__) | sval;
+    }
+    return &tree->vec64[sval >> imap__slot_shift__];
+}
+
 static void imap_remove(imap_node_t *tree, uint64_t x) {
-    uint32_t *slotstack[16 + 1];
+    imap_slot_t *slotstack[16 + 1];
     uint32_t stackp;
     imap_node_t *node = tree;
-    uint32_t *slot;
-    uint32_t sval, pval, posn = 16, dirn = 0;
+    imap_slot_t *slot;
+    imap_slot_t sval, pval;
+    uint32_t posn = 16, dirn = 0;
     stackp = 0;
     for (;;) {
-        slot = &node->vec32[dirn];
+        slot = &node->vec[dirn];
         sval = *slot;
         if (!(sval & imap__slot_node__)) {
             if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull)) {
@@ -461,8 +1084,9 @@ static void imap_remove(imap_node_t *tree, uint64_t x) {
 
 static imap_pair_t imap_iterate(imap_node_t *tree, imap_iter_t *iter, int restart) {
     imap_node_t *node;
-    uint32_t *slot;
-    uint32_t sval, dirn;
+    imap_slot_t *slot;
+    imap_slot_t sval;
+    uint32_t dirn;
     if (restart) {
         iter->stackp = 0;
         sval = dirn = 0;
@@ -480,7 +1104,7 @@ static imap_pair_t imap_iterate(imap_node_t *tree, imap_iter_t *iter, int restar
         }
     enter:
         node = imap__node__(tree, sval & imap__slot_value__);
-        slot = &node->vec32[dirn];
+        slot = &node->vec[dirn];
         sval = *slot;
         if (sval & imap__slot_node__)
             // push node into stack
@@ -498,36 +1122,262 @@ ezKeyMap* ezKeyMapNew(ezKeyMap *old, size_t capacity) {
         capacity = EZMAP_DEFAULT_CAPACITY;
     result->capacity = capacity;
     result->count = 0;
+    result->mapped = 0;
+    result->valueSize = 0;
+    result->strings = NULL;
+    result->filter = NULL;
     result->tree = imap_ensure(NULL, capacity);
     return result;
 }
 
-int ezKeyMapSet(ezKeyMap *map, uint64_t key, void *item) {
-    uint32_t *slot = imap_find(map, key, 1);
-    if (!slot)
+// Typed values are kept in blocks rounded up to 8 bytes, other maps use cells
+static inline uint32_t KeyMapValueBytes(ezKeyMap *map) {
+    return map->valueSize ? (uint32_t)((map->valueSize + 7) & ~(size_t)7) : sizeof(uint64_t);
+}
+
+ezKeyMap* ezKeyMapNewTyped(size_t valueSize, size_t capacity) {
+    if (!valueSize || valueSize > sizeof(imap_node_t))
+        return NULL;
+    ezKeyMap *result = EZ_MALLOC(sizeof(ezKeyMap));
+    if (!capacity)
+        capacity = EZMAP_DEFAULT_CAPACITY;
+    result->capacity = capacity;
+    result->count = 0;
+    result->mapped = 0;
+    result->valueSize = valueSize;
+    result->strings = NULL;
+    result->filter = NULL;
+    result->tree = imap_grow(NULL, capacity, KeyMapValueBytes(result));
+    return result;
+}
+
+static inline void KeyMapSetValue(ezKeyMap *map, imap_slot_t *slot, void *value) {
+    if (!map->valueSize)
+        imap_setval(map->tree, slot, (uint64_t)value);
+    else if (value)
+        memcpy(imap_setblock(map->tree, slot, KeyMapValueBytes(map)), value, map->valueSize);
+    else
+        memset(imap_setblock(map->tree, slot, KeyMapValueBytes(map)), 0, map->valueSize);
+}
+
+static inline void* KeyMapGetValue(ezKeyMap *map, imap_slot_t *slot) {
+    if (map->valueSize)
+        return &map->tree->vec64[*slot >> imap__slot_shift__];
+    return (void*)imap_getval(map->tree, slot);
+}
+
+// Grows the tree in steps of the map's capacity, then makes sure there is room
+// for `count` more keys as deletes can leave the free lists fragmented. Near the
+// size limit the doubled capacity may not fit when `count` more keys still do.
+// If `retired` isn't NULL a replaced tree is stored there instead of being freed
+static int KeyMapReserve(ezKeyMap *map, size_t count, imap_node_t **retired) {
+    imap_node_t *tree = NULL;
+    if (map->count + count > map->capacity) {
+        size_t capacity = map->capacity;
+        while (map->count + count > capacity)
+            capacity *= 2;
+        if ((tree = imap_grow(map->tree, capacity - map->count, KeyMapValueBytes(map))))
+            map->capacity = capacity;
+    }
+    if (!tree && !(tree = imap_grow(map->tree, count, KeyMapValueBytes(map))))
         return 0;
-    imap_setval64(map->tree, slot, (uint64_t)item);
+    if (tree != map->tree) {
+        if (retired)
+            *retired = map->tree;
+        else
+            imap__tree_free__(map->tree);
+        map->tree = tree;
+    }
     return 1;
 }
 
+static void KeyMapFilterAdd(ezKeyMap *map, uint64_t key);
+
+// Only a filter can say a key is missing without walking the trie
+#define KEYMAP_FILTERED(map, key) ((map)->filter && !ezBloomHas((map)->filter, (key)))
+
+int ezKeyMapSet(ezKeyMap *map, uint64_t key, void *item) {
+    if (map->mapped || !KeyMapReserve(map, 1, NULL))
+        return 0;
+    imap_slot_t *slot = imap_assign(map->tree, key);
+    if (!(*slot & imap__slot_value__)) {
+        map->count++;
+        if (map->filter)
+            KeyMapFilterAdd(map, key);
+    }
+    KeyMapSetValue(map, slot, item);
+    return 1;
+}
 
 void* ezKeyMapGet(ezKeyMap *map, uint64_t key) {
-    uint32_t *slot = imap_find(map, key, 0);
-    return slot ? (void*)imap_getval(map->tree, slot) : NULL;
+    if (KEYMAP_FILTERED(map, key))
+        return NULL;
+    imap_slot_t *slot = imap_lookup(map->tree, key);
+    return slot ? KeyMapGetValue(map, slot) : NULL;
 }
 
 void* ezKeyMapDel(ezKeyMap *map, uint64_t key) {
-    if (!map->count)
-        return NULL;
-    uint32_t *slot = imap_find(map, key, 0);
+    if (map->valueSize)
+        return ezKeyMapRemove(map, key) ? EZMAP_REMOVED : NULL;
+    imap_slot_t *slot = map->mapped || KEYMAP_FILTERED(map, key) ? NULL : imap_lookup(map->tree, key);
     if (!slot)
         return NULL;
-    void* val = (void*)imap_getval(map->tree, slot);
+    void* val = KeyMapGetValue(map, slot);
     imap_remove(map->tree, key);
     map->count--;
     return val;
 }
 
+int ezKeySetAdd(ezKeySet *set, uint64_t key) {
+    return ezKeyMapSet(set, key, NULL);
+}
+
+int ezKeySetHas(ezKeySet *set, uint64_t key) {
+    return !KEYMAP_FILTERED(set, key) && imap_lookup(set->tree, key);
+}
+
+int ezKeyMapRemove(ezKeyMap *map, uint64_t key) {
+    if (map->mapped || KEYMAP_FILTERED(map, key) || !imap_lookup(map->tree, key))
+        return 0;
+    imap_remove(map->tree, key);
+    map->count--;
+    return 1;
+}
+
+int ezKeySetRemove(ezKeySet *set, uint64_t key) {
+    return ezKeyMapRemove(set, key);
+}
+
+typedef struct {
+    imap_node_t *node; // next node to visit, already prefetched
+    uint64_t *cell;    // boxed value of a found key, already prefetched
+    size_t index;
+} KeyMapCursor;
+
+// Points the cursor at the root for key `index`, returns 0 if the tree is empty
+static inline int KeyMapCursorStart(imap_node_t *tree, KeyMapCursor *cursor, size_t index) {
+    imap_slot_t sval = tree->vec[imap__tree_root__];
+    if (!(sval & imap__slot_node__))
+        return 0;
+    cursor->node = imap__node__(tree, sval & imap__slot_value__);
+    cursor->cell = NULL;
+    cursor->index = index;
+    imap__prefetch__(cursor->node);
+    return 1;
+}
+
+// Interleaved imap_lookup over `count` keys, each cursor takes one step per
+// round so up to EZMAP_BATCH_WIDTH loads are in flight. With `results` NULL the
+// paths are only pulled into cache, which is how ezKeyMapSetMany warms them.
+// Typed maps get a pointer to the value's block rather than its contents
+static size_t KeyMapWalkMany(imap_node_t *tree, const uint64_t *keys, void **results, size_t count, int typed) {
+    KeyMapCursor cursors[EZMAP_BATCH_WIDTH];
+    size_t live = 0, next = 0, found = 0;
+    for (;;) {
+        while (live < EZMAP_BATCH_WIDTH && next < count) {
+            if (KeyMapCursorStart(tree, &cursors[live], next))
+                live++;
+            else if (results)
+                results[next] = NULL;
+            next++;
+        }
+        if (!live)
+            return found;
+        for (size_t i = 0; i < live;) {
+            KeyMapCursor *cursor = &cursors[i];
+            int done = 1;
+            if (cursor->cell) {
+                if (results)
+                    results[cursor->index] = typed ? (void*)cursor->cell : (void*)*cursor->cell;
+                found++;
+            } else {
+                uint64_t x = keys[cursor->index];
+                imap_node_t *node = cursor->node;
+                imap_slot_t sval = node->vec[imap__xdir__(x, imap__node_pos__(node))];
+                if (sval & imap__slot_node__) {
+                    cursor->node = imap__node__(tree, sval & imap__slot_value__);
+                    imap__prefetch__(cursor->node);
+                    done = 0;
+                } else if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull)) {
+                    if (imap__slot_boxed__(sval)) {
+                        cursor->cell = &tree->vec64[sval >> imap__slot_shift__];
+                        imap__prefetch__(cursor->cell);
+                        done = 0;
+                    } else {
+                        if (results)
+                            results[cursor->index] = (void*)(uint64_t)(sval >> imap__slot_shift__);
+                        found++;
+                    }
+                } else if (results)
+                    results[cursor->index] = NULL;
+            }
+            if (!done)
+                i++;
+            else {
+                // Retire the cursor, the next key takes its place in the following round
+                for (; next < count && !KeyMapCursorStart(tree, cursor, next); next++)
+                    if (results)
+                        results[next] = NULL;
+                if (next < count)
+                    next++, i++;
+                else
+                    *cursor = cursors[--live];
+            }
+        }
+    }
+}
+
+// With a filter only the keys that pass it are walked, a block at a time
+#define KEYMAP_FILTER_BLOCK (EZMAP_BATCH_WIDTH * 8)
+
+size_t ezKeyMapGetMany(ezKeyMap *map, const uint64_t *keys, void **results, size_t count) {
+    if (!map->filter)
+        return KeyMapWalkMany(map->tree, keys, results, count, map->valueSize != 0);
+    uint64_t passed[KEYMAP_FILTER_BLOCK];
+    void *found[KEYMAP_FILTER_BLOCK];
+    size_t index[KEYMAP_FILTER_BLOCK], total = 0;
+    for (size_t offset = 0; offset < count; offset += KEYMAP_FILTER_BLOCK) {
+        size_t end = count - offset < KEYMAP_FILTER_BLOCK ? count : offset + KEYMAP_FILTER_BLOCK, n = 0;
+        for (size_t i = offset; i < end; i++) {
+            results[i] = NULL;
+            if (ezBloomHas(map->filter, keys[i])) {
+                passed[n] = keys[i];
+                index[n++] = i;
+            }
+        }
+        total += KeyMapWalkMany(map->tree, passed, found, n, map->valueSize != 0);
+        for (size_t i = 0; i < n; i++)
+            results[index[i]] = found[i];
+    }
+    return total;
+}
+
+// Keys are inserted in blocks: room for the whole block is reserved first so
+// the tree can't move, the paths are warmed by an interleaved walk and then
+// the keys are assigned in order (so later duplicates win, as with Set)
+#define KEYMAP_SET_BLOCK (EZMAP_BATCH_WIDTH * 8)
+
+size_t ezKeyMapSetMany(ezKeyMap *map, const uint64_t *keys, void **values, size_t count) {
+    if (map->mapped)
+        return 0;
+    for (size_t offset = 0; offset < count; offset += KEYMAP_SET_BLOCK) {
+        size_t n = count - offset < KEYMAP_SET_BLOCK ? count - offset : KEYMAP_SET_BLOCK;
+        if (!KeyMapReserve(map, n, NULL))
+            return offset;
+        KeyMapWalkMany(map->tree, keys + offset, NULL, n, 0);
+        for (size_t i = offset; i < offset + n; i++) {
+            imap_slot_t *slot = imap_assign(map->tree, keys[i]);
+            if (!(*slot & imap__slot_value__)) {
+                map->count++;
+                if (map->filter)
+                    KeyMapFilterAdd(map, keys[i]);
+            }
+            KeyMapSetValue(map, slot, values[i]);
+        }
+    }
+    return count;
+}
+
 int ezKeyMapEach(ezKeyMap *map, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata) {
     imap_iter_t iter;
     imap_pair_t pair = imap_iterate(map->tree, &iter, 1);
@@ -537,7 +1387,7 @@ int ezKeyMapEach(ezKeyMap *map, int(*callback)(ezKeyValuePair *pair, uint64_t, v
         if (!pair.slot)
             break;
         ezpair.key = pair.x;
-        ezpair.val = (void*)imap_getval(map->tree, pair.slot);
+        ezpair.val = KeyMapGetValue(map, pair.slot);
         int result = callback(&ezpair, i++, userdata);
         if (!result)
             return result;
@@ -547,113 +1397,2705 @@ int ezKeyMapEach(ezKeyMap *map, int(*callback)(ezKeyValuePair *pair, uint64_t, v
     return 0;
 }
 
-void ezKeyMapDestroy(ezKeyMap *map) {
-    IMAP_ALIGNED_FREE(map->tree);
-    EZ_FREE(map);
+// A path entry is a node offset with the direction taken + 1 in its low 5 bits,
+// 0 is before the first slot and 17 is past the last
+#define KEYMAP_CURSOR_BEFORE 0
+#define KEYMAP_CURSOR_AFTER 17
+
+static inline void KeyMapCursorPush(ezKeyMapCursor *cursor, imap_slot_t offset, uint32_t dirn) {
+    cursor->path[cursor->depth++] = offset | dirn;
 }
 
-static void MM86128(const void *key, const int len, uint32_t seed, void *out) {
-#define ROTL32(x, r) ((x << r) | (x >> (32 - r)))
-#define FMIX32(h) h^=h>>16; h*=0x85ebca6b; h^=h>>13; h*=0xc2b2ae35; h^=h>>16;
-    const uint8_t * data = (const uint8_t*)key;
-    const int nblocks = len / 16;
-    uint32_t h1 = seed;
-    uint32_t h2 = seed;
-    uint32_t h3 = seed;
-    uint32_t h4 = seed;
-    uint32_t c1 = 0x239b961b;
-    uint32_t c2 = 0xab0e9789;
-    uint32_t c3 = 0x38b34ae5;
-    uint32_t c4 = 0xa1e38b93;
-    const uint32_t * blocks = (const uint32_t *)(data + nblocks*16);
-    for (int i = -nblocks; i; i++) {
-        uint32_t k1 = blocks[i*4+0];
-        uint32_t k2 = blocks[i*4+1];
-        uint32_t k3 = blocks[i*4+2];
-        uint32_t k4 = blocks[i*4+3];
-        k1 *= c1; k1  = ROTL32(k1,15); k1 *= c2; h1 ^= k1;
-        h1 = ROTL32(h1,19); h1 += h2; h1 = h1*5+0x561ccd1b;
-        k2 *= c2; k2  = ROTL32(k2,16); k2 *= c3; h2 ^= k2;
-        h2 = ROTL32(h2,17); h2 += h3; h2 = h2*5+0x0bcaa747;
-        k3 *= c3; k3  = ROTL32(k3,17); k3 *= c4; h3 ^= k3;
-        h3 = ROTL32(h3,15); h3 += h4; h3 = h3*5+0x96cd1c35;
-        k4 *= c4; k4  = ROTL32(k4,18); k4 *= c1; h4 ^= k4;
-        h4 = ROTL32(h4,13); h4 += h1; h4 = h4*5+0x32ac3b17;
-    }
-    const uint8_t * tail = (const uint8_t*)(data + nblocks*16);
-    uint32_t k1 = 0;
-    uint32_t k2 = 0;
-    uint32_t k3 = 0;
-    uint32_t k4 = 0;
-    switch(len & 15) {
-        case 15:
-            k4 ^= tail[14] << 16;
-        case 14:
-            k4 ^= tail[13] << 8;
-        case 13:
-            k4 ^= tail[12] << 0;
-            k4 *= c4; k4  = ROTL32(k4,18); k4 *= c1; h4 ^= k4;
-        case 12:
-            k3 ^= tail[11] << 24;
-        case 11:
-            k3 ^= tail[10] << 16;
-        case 10:
-            k3 ^= tail[ 9] << 8;
-        case 9:
-            k3 ^= tail[ 8] << 0;
-            k3 *= c3; k3  = ROTL32(k3,17); k3 *= c4; h3 ^= k3;
-        case 8:
-            k2 ^= tail[ 7] << 24;
-        case 7:
-            k2 ^= tail[ 6] << 16;
-        case 6:
-            k2 ^= tail[ 5] << 8;
-        case 5:
-            k2 ^= tail[ 4] << 0;
-            k2 *= c2; k2  = ROTL32(k2,16); k2 *= c3; h2 ^= k2;
-        case 4:
-            k1 ^= tail[ 3] << 24;
-        case 3:
-            k1 ^= tail[ 2] << 16;
-        case 2:
-            k1 ^= tail[ 1] << 8;
-        case 1:
-            k1 ^= tail[ 0] << 0;
-            k1 *= c1; k1  = ROTL32(k1,15); k1 *= c2; h1 ^= k1;
-    };
-    h1 ^= len; h2 ^= len; h3 ^= len; h4 ^= len;
-    h1 += h2; h1 += h3; h1 += h4;
-    h2 += h1; h3 += h1; h4 += h1;
-    FMIX32(h1); FMIX32(h2); FMIX32(h3); FMIX32(h4);
-    h1 += h2; h1 += h3; h1 += h4;
-    h2 += h1; h3 += h1; h4 += h1;
-    ((uint32_t*)out)[0] = h1;
-    ((uint32_t*)out)[1] = h2;
-    ((uint32_t*)out)[2] = h3;
-    ((uint32_t*)out)[3] = h4;
+// Moves to the next (step 1) or previous (step -1) key from the top of the path,
+// popping nodes that run out and descending into the nearest child otherwise
+static int KeyMapCursorScan(ezKeyMapCursor *cursor, int step) {
+    imap_node_t *tree = cursor->map->tree;
+    while (cursor->depth) {
+        uint64_t entry = cursor->path[cursor->depth - 1];
+        imap_slot_t offset = entry & ~(uint64_t)31, sval = 0;
+        imap_node_t *node = imap__node__(tree, offset);
+        int dirn = (int)(entry & 31) + step;
+        for (; dirn > KEYMAP_CURSOR_BEFORE && dirn < KEYMAP_CURSOR_AFTER; dirn += step)
+            if ((sval = node->vec[dirn - 1]) & (imap__slot_node__ | imap__slot_value__))
+                break;
+        if (dirn <= KEYMAP_CURSOR_BEFORE || dirn >= KEYMAP_CURSOR_AFTER) {
+            cursor->depth--;
+            continue;
+        }
+        cursor->path[cursor->depth - 1] = offset | dirn;
+        if (sval & imap__slot_node__) {
+            KeyMapCursorPush(cursor, sval & imap__slot_value__, step > 0 ? KEYMAP_CURSOR_BEFORE : KEYMAP_CURSOR_AFTER);
+            continue;
+        }
+        cursor->key = (imap__node_prefix__(node) & ~0xfull) | (uint64_t)(dirn - 1);
+        cursor->value = KeyMapGetValue(cursor->map, &node->vec[dirn - 1]);
+        return 1;
+    }
+    return 0;
 }
 
-uint64_t MurmurHash(const void *data, size_t len, uint32_t seed) {
-    char out[16];
-    MM86128(data, (int)len, (uint32_t)seed, &out);
-    return *(uint64_t*)out;
+static int KeyMapCursorStartAt(ezKeyMap *map, ezKeyMapCursor *cursor, uint32_t dirn, int step) {
+    imap_slot_t root = map->tree->vec[imap__tree_root__];
+    cursor->map = map;
+    cursor->depth = 0;
+    if (!(root & imap__slot_node__))
+        return 0;
+    KeyMapCursorPush(cursor, root & imap__slot_value__, dirn);
+    return KeyMapCursorScan(cursor, step);
 }
 
-#define HASH_WRAPPER(FN, ...)                              \
-do {                                                       \
-    int64_t hash = MurmurHash((void*)key, strlen(key), 0); \
-    return ezKeyMap##FN((ezKeyMap*)dict, __VA_ARGS__);     \
-} while(0)
+int ezKeyMapFirst(ezKeyMap *map, ezKeyMapCursor *cursor) {
+    return KeyMapCursorStartAt(map, cursor, KEYMAP_CURSOR_BEFORE, 1);
+}
 
-int ezDictSet(ezDict *dict, const char *key, void *value) {
-    HASH_WRAPPER(Set, hash, value);
+int ezKeyMapLast(ezKeyMap *map, ezKeyMapCursor *cursor) {
+    return KeyMapCursorStartAt(map, cursor, KEYMAP_CURSOR_AFTER, -1);
 }
 
-void* ezDictGet(ezDict *dict, const char *key) {
-    HASH_WRAPPER(Get, hash);
+// Follows `key` down as far as it goes. Where it leaves the tree the rest of
+// that node (or all of it, if its prefix already differs) is skipped by a scan
+int ezKeyMapSeek(ezKeyMap *map, ezKeyMapCursor *cursor, uint64_t key) {
+    imap_node_t *tree = map->tree;
+    imap_slot_t sval = tree->vec[imap__tree_root__];
+    cursor->map = map;
+    cursor->depth = 0;
+    while (sval & imap__slot_node__) {
+        imap_slot_t offset = sval & imap__slot_value__;
+        imap_node_t *node = imap__node__(tree, offset);
+        uint32_t posn = imap__node_pos__(node);
+        uint64_t prefix = imap__node_prefix__(node) & ~0xfull, xprefix = imap__xpfx__(key, posn);
+        if (xprefix != prefix) {
+            KeyMapCursorPush(cursor, offset, xprefix < prefix ? KEYMAP_CURSOR_BEFORE : KEYMAP_CURSOR_AFTER);
+            break;
+        }
+        uint32_t dirn = imap__xdir__(key, posn);
+        KeyMapCursorPush(cursor, offset, dirn + 1);
+        sval = node->vec[dirn];
+        if (!posn && (sval & imap__slot_value__)) {
+            cursor->key = key;
+            cursor->value = KeyMapGetValue(map, &node->vec[dirn]);
+            return 1;
+        }
+    }
+    return KeyMapCursorScan(cursor, 1);
 }
 
-void* ezDictDel(ezDict *dict, const char *key) {
-    HASH_WRAPPER(Del, hash);
+int ezKeyMapNext(ezKeyMapCursor *cursor) {
+    return KeyMapCursorScan(cursor, 1);
+}
+
+int ezKeyMapPrev(ezKeyMapCursor *cursor) {
+    return KeyMapCursorScan(cursor, -1);
+}
+
+// Visits [from, last], inclusive so a range can end at UINT64_MAX
+static size_t KeyMapVisit(ezKeyMap *map, uint64_t from, uint64_t last, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata) {
+    ezKeyMapCursor cursor;
+    ezKeyValuePair pair;
+    size_t count = 0;
+    for (int found = ezKeyMapSeek(map, &cursor, from); found && cursor.key <= last; found = ezKeyMapNext(&cursor)) {
+        pair.key = cursor.key;
+        pair.val = cursor.value;
+        if (!callback(&pair, count++, userdata))
+            break;
+    }
+    return count;
+}
+
+size_t ezKeyMapRange(ezKeyMap *map, uint64_t from, uint64_t to, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata) {
+    return from < to ? KeyMapVisit(map, from, to - 1, callback, userdata) : 0;
+}
+
+size_t ezKeyMapPrefix(ezKeyMap *map, uint64_t prefix, unsigned int bits, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata) {
+    uint64_t mask = !bits ? 0 : bits >= 64 ? ~0ull : ~0ull << (64 - bits);
+    return KeyMapVisit(map, prefix & mask, (prefix & mask) | ~mask, callback, userdata);
+}
+
+static void KeyMapCountNodes(imap_node_t *tree, imap_slot_t offset, uint64_t *nodes, uint64_t *values) {
+    imap_node_t *node = imap__node__(tree, offset);
+    ++*nodes;
+    for (uint32_t dirn = 0; dirn < 16; dirn++) {
+        imap_slot_t sval = node->vec[dirn];
+        if (sval & imap__slot_node__)
+            KeyMapCountNodes(tree, sval & imap__slot_value__, nodes, values);
+        else if (imap__slot_boxed__(sval))
+            ++*values;
+    }
+}
+
+// Copies a node into `dst` before its children (depth first), a leaf's values
+// are allocated as it's copied so they end up next to it. Returns the new offset
+static imap_slot_t KeyMapCopyNode(imap_node_t *dst, imap_node_t *src, imap_slot_t offset, uint32_t valsize) {
+    imap_slot_t mark = imap__alloc_node__(dst);
+    imap_node_t *from = imap__node__(src, offset), *to = imap__node__(dst, mark);
+    *to = *from;
+    for (uint32_t dirn = 0; dirn < 16; dirn++) {
+        imap_slot_t sval = from->vec[dirn];
+        if (sval & imap__slot_node__)
+            to->vec[dirn] = (sval & imap__slot_pmask__) | imap__slot_node__ | KeyMapCopyNode(dst, src, sval & imap__slot_value__, valsize);
+        else if (imap__slot_boxed__(sval)) {
+            to->vec[dirn] = sval & imap__slot_pmask__;
+            if (valsize == sizeof(uint64_t))
+                imap_setval64(dst, &to->vec[dirn], src->vec64[sval >> imap__slot_shift__]);
+            else
+                memcpy(imap_setblock(dst, &to->vec[dirn], valsize), &src->vec64[sval >> imap__slot_shift__], valsize);
+        }
+    }
+    return mark;
+}
+
+// Exact size of a tree holding `nodes` nodes and `values` boxed values of
+// `valsize` bytes, the header node's spare cells are used first
+static uint64_t KeyMapTreeSize(uint64_t nodes, uint64_t values, uint32_t valsize) {
+    uint64_t cells = valsize == sizeof(uint64_t) ? imap__node_vals__ - imap__tree_cell__ : 0;
+    uint64_t pernode = sizeof(imap_node_t) / valsize;
+    if (values > cells)
+        nodes += (values - cells + pernode - 1) / pernode;
+    return (nodes + 1) * sizeof(imap_node_t);
+}
+
+// Same as KeyMapReserve, a replaced tree goes to `retired` if it isn't NULL
+static int KeyMapCompact(ezKeyMap *map, imap_node_t **retired) {
+    if (map->mapped)
+        return 0;
+    imap_node_t *tree = map->tree;
+    imap_slot_t root = tree->vec[imap__tree_root__];
+    uint64_t nodes = 0, values = 0;
+    if (root & imap__slot_node__)
+        KeyMapCountNodes(tree, root & imap__slot_value__, &nodes, &values);
+    uint32_t valsize = KeyMapValueBytes(map);
+    imap_node_t *compact = imap_create(KeyMapTreeSize(nodes, values, valsize), valsize);
+    if (!compact)
+        return 0;
+    if (root & imap__slot_node__)
+        compact->vec[imap__tree_root__] = imap__slot_node__ | KeyMapCopyNode(compact, tree, root & imap__slot_value__, valsize);
+    assert(compact->vec[imap__tree_mark__] == compact->vec[imap__tree_size__]);
+    if (retired)
+        *retired = tree;
+    else
+        imap__tree_free__(tree);
+    map->tree = compact;
+    map->capacity = map->count > EZMAP_DEFAULT_CAPACITY ? map->count : EZMAP_DEFAULT_CAPACITY;
+    return 1;
+}
+
+static int KeyMapFilterBuild(ezKeyMap *map, double falsePositiveRate);
+
+int ezKeyMapCompact(ezKeyMap *map) {
+    if (!KeyMapCompact(map, NULL))
+        return 0;
+    // Drop the bits of deleted keys, keep the old filter if this fails
+    if (map->filter)
+        KeyMapFilterBuild(map, map->filter->falsePositiveRate);
+    return 1;
+}
+
+// The keys in [lo, hi) share every nibble above the highest one where the first
+// and last differ, so that is the position of the node holding them (0 for a
+// leaf). Each run of keys with the same nibble there becomes one child
+static void KeyMapBuildCount(const uint64_t *keys, void **values, size_t lo, size_t hi, uint64_t *nodes, uint64_t *distinct, uint64_t *boxed) {
+    uint32_t posn = imap__xpos__(keys[lo] ^ keys[hi - 1]);
+    ++*nodes;
+    for (size_t i = lo, j; i < hi; i = j) {
+        uint32_t dirn = imap__xdir__(keys[i], posn);
+        for (j = i + 1; j < hi && imap__xdir__(keys[j], posn) == dirn; j++);
+        if (posn)
+            KeyMapBuildCount(keys, values, i, j, nodes, distinct, boxed);
+        else {
+            ++*distinct;
+            if (values && (uint64_t)values[j - 1] > imap__slot_value__ >> imap__slot_shift__)
+                ++*boxed;
+        }
+    }
+}
+
+static imap_slot_t KeyMapBuildNode(imap_node_t *tree, const uint64_t *keys, void **values, size_t lo, size_t hi) {
+    uint32_t posn = imap__xpos__(keys[lo] ^ keys[hi - 1]);
+    imap_slot_t mark = imap__alloc_node__(tree);
+    imap_node_t *node = imap__node__(tree, mark);
+    *node = imap__node_zero__;
+    imap__node_setprefix__(node, imap__xpfx__(keys[lo], posn) | posn);
+    for (size_t i = lo, j; i < hi; i = j) {
+        uint32_t dirn = imap__xdir__(keys[i], posn);
+        for (j = i + 1; j < hi && imap__xdir__(keys[j], posn) == dirn; j++);
+        if (posn)
+            node->vec[dirn] |= imap__slot_node__ | KeyMapBuildNode(tree, keys, values, i, j);
+        else
+            imap_setval(tree, &node->vec[dirn], values ? (uint64_t)values[j - 1] : 0);
+    }
+    return mark;
+}
+
+ezKeyMap* ezKeyMapBuild(const uint64_t *keys, void **values, size_t count) {
+    if (!count)
+        return ezKeyMapNew(NULL, 0);
+    for (size_t i = 1; i < count; i++)
+        if (keys[i] < keys[i - 1])
+            return NULL;
+    uint64_t nodes = 0, distinct = 0, boxed = 0;
+    KeyMapBuildCount(keys, values, 0, count, &nodes, &distinct, &boxed);
+    imap_node_t *tree = imap_create(KeyMapTreeSize(nodes, boxed, sizeof(uint64_t)), sizeof(uint64_t));
+    if (!tree)
+        return NULL;
+    tree->vec[imap__tree_root__] = imap__slot_node__ | KeyMapBuildNode(tree, keys, values, 0, count);
+    assert(tree->vec[imap__tree_mark__] == tree->vec[imap__tree_size__]);
+    ezKeyMap *map = EZ_MALLOC(sizeof(ezKeyMap));
+    map->tree = tree;
+    map->count = distinct;
+    map->capacity = distinct > EZMAP_DEFAULT_CAPACITY ? distinct : EZMAP_DEFAULT_CAPACITY;
+    map->mapped = 0;
+    map->valueSize = 0;
+    map->strings = NULL;
+    map->filter = NULL;
+    return map;
+}
+
+enum {
+    KEYMAP_UNION,
+    KEYMAP_INTERSECT,
+    KEYMAP_DIFFERENCE,
+    KEYMAP_SYMMETRIC
+};
+
+// Moves the cursor to the first key >= `key`. Nearby keys are reached with a
+// few Next steps, anything further is a seek from the root that skips the
+// subtrees in between
+static int KeyMapCursorCatchUp(ezKeyMapCursor *cursor, uint64_t key) {
+    for (int i = 0; i < 4; i++) {
+        if (!ezKeyMapNext(cursor))
+            return 0;
+        if (cursor->key >= key)
+            return 1;
+    }
+    return ezKeyMapSeek(cursor->map, cursor, key);
+}
+
+// Merges the two maps in key order, calling `emit` (if not NULL) for each key in
+// the result. Returns the number of keys in the result
+static size_t KeyMapMerge(ezKeyMap *a, ezKeyMap *b, int op, void(*emit)(uint64_t, void*, void*), void *userdata) {
+    ezKeyMapCursor ca, cb;
+    int ha = ezKeyMapFirst(a, &ca), hb = ezKeyMapFirst(b, &cb);
+    size_t count = 0;
+    while (ha || hb) {
+        if (op == KEYMAP_INTERSECT && !(ha && hb))
+            break;
+        if (op == KEYMAP_DIFFERENCE && !ha)
+            break;
+        if (ha && (!hb || ca.key < cb.key)) {
+            if (op == KEYMAP_INTERSECT)
+                ha = KeyMapCursorCatchUp(&ca, cb.key);
+            else {
+                if (emit)
+                    emit(ca.key, ca.value, userdata);
+                count++;
+                ha = ezKeyMapNext(&ca);
+            }
+        } else if (hb && (!ha || cb.key < ca.key)) {
+            if (op == KEYMAP_INTERSECT || op == KEYMAP_DIFFERENCE)
+                hb = KeyMapCursorCatchUp(&cb, ca.key);
+            else {
+                if (emit)
+                    emit(cb.key, cb.value, userdata);
+                count++;
+                hb = ezKeyMapNext(&cb);
+            }
+        } else {
+            if (op == KEYMAP_UNION || op == KEYMAP_INTERSECT) {
+                if (emit)
+                    emit(ca.key, ca.value, userdata);
+                count++;
+            }
+            ha = ezKeyMapNext(&ca);
+            hb = ezKeyMapNext(&cb);
+        }
+    }
+    return count;
+}
+
+typedef struct {
+    uint64_t *keys;
+    void **values;
+    size_t count;
+} KeyMapMergeBuffer;
+
+static void KeyMapMergeEmit(uint64_t key, void *value, void *userdata) {
+    KeyMapMergeBuffer *buffer = (KeyMapMergeBuffer*)userdata;
+    buffer->keys[buffer->count] = key;
+    buffer->values[buffer->count++] = value;
+}
+
+// Keys come out sorted so the result can be built in one pass, typed values are
+// pointers into the source trees so typed results are filled with SetMany
+static ezKeyMap* KeyMapCombine(ezKeyMap *a, ezKeyMap *b, int op) {
+    if (a->valueSize != b->valueSize)
+        return NULL;
+    size_t bound = op == KEYMAP_INTERSECT ? (a->count < b->count ? a->count : b->count) :
+                   op == KEYMAP_DIFFERENCE ? a->count : a->count + b->count;
+    KeyMapMergeBuffer buffer = {0};
+    buffer.keys = EZ_MALLOC((bound ? bound : 1) * sizeof(uint64_t));
+    buffer.values = EZ_MALLOC((bound ? bound : 1) * sizeof(void*));
+    ezKeyMap *result = NULL;
+    if (buffer.keys && buffer.values) {
+        KeyMapMerge(a, b, op, KeyMapMergeEmit, &buffer);
+        if (!a->valueSize)
+            result = ezKeyMapBuild(buffer.keys, buffer.values, buffer.count);
+        else if ((result = ezKeyMapNewTyped(a->valueSize, buffer.count)) &&
+                 ezKeyMapSetMany(result, buffer.keys, buffer.values, buffer.count) != buffer.count) {
+            ezKeyMapDestroy(result);
+            result = NULL;
+        }
+    }
+    EZ_FREE(buffer.keys);
+    EZ_FREE(buffer.values);
+    return result;
+}
+
+ezKeyMap* ezKeyMapUnion(ezKeyMap *a, ezKeyMap *b) {
+    return KeyMapCombine(a, b, KEYMAP_UNION);
+}
+
+ezKeyMap* ezKeyMapIntersect(ezKeyMap *a, ezKeyMap *b) {
+    return KeyMapCombine(a, b, KEYMAP_INTERSECT);
+}
+
+ezKeyMap* ezKeyMapDifference(ezKeyMap *a, ezKeyMap *b) {
+    return KeyMapCombine(a, b, KEYMAP_DIFFERENCE);
+}
+
+ezKeyMap* ezKeyMapSymmetricDifference(ezKeyMap *a, ezKeyMap *b) {
+    return KeyMapCombine(a, b, KEYMAP_SYMMETRIC);
+}
+
+size_t ezKeyMapIntersectCount(ezKeyMap *a, ezKeyMap *b) {
+    return KeyMapMerge(a, b, KEYMAP_INTERSECT, NULL, NULL);
+}
+
+size_t ezKeyMapUnionCount(ezKeyMap *a, ezKeyMap *b) {
+    return a->count + b->count - ezKeyMapIntersectCount(a, b);
+}
+
+size_t ezKeyMapDifferenceCount(ezKeyMap *a, ezKeyMap *b) {
+    return a->count - ezKeyMapIntersectCount(a, b);
+}
+
+size_t ezKeyMapSymmetricDifferenceCount(ezKeyMap *a, ezKeyMap *b) {
+    return a->count + b->count - 2 * ezKeyMapIntersectCount(a, b);
+}
+
+// Files are a 64 byte header followed by the tree, so the tree stays 64 byte
+// aligned when the file is mapped. `byteOrder` and `slotBits` catch files
+// written on a machine or build with a different layout
+#define KEYMAP_FILE_MAGIC "EZKEYMAP"
+#define KEYMAP_FILE_VERSION 1
+#define KEYMAP_FILE_BYTE_ORDER 0x01020304
+
+typedef struct {
+    char magic[8];
+    uint32_t version, byteOrder;
+    uint32_t slotBits, headerSize;
+    uint64_t count, treeSize;
+    uint32_t valueSize;
+    uint8_t reserved[20];
+} KeyMapFileHeader;
+
+static void KeyMapUnmap(void *base, size_t size) {
+#if defined(_WIN32) || defined(_WIN64)
+    (void)size;
+    UnmapViewOfFile(base);
+#else
+    munmap(base, size);
+#endif
+}
+
+int ezKeyMapSave(ezKeyMap *map, const char *path) {
+    KeyMapFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, KEYMAP_FILE_MAGIC, sizeof(header.magic));
+    header.version = KEYMAP_FILE_VERSION;
+    header.byteOrder = KEYMAP_FILE_BYTE_ORDER;
+    header.slotBits = sizeof(map->tree->vec[0]) * 8;
+    header.headerSize = sizeof(header);
+    header.count = map->count;
+    header.valueSize = (uint32_t)map->valueSize;
+    // Only the used part of the tree is written, its size is trimmed to match
+    uint64_t used = map->tree->vec[imap__tree_mark__];
+    header.treeSize = used;
+    imap_node_t first = map->tree[0];
+    first.vec[imap__tree_size__] = used;
+    first.vec[imap__tree_resv__] = 0;
+
+    size_t length = strlen(path);
+    char *temp = EZ_MALLOC(length + 5);
+    memcpy(temp, path, length);
+    memcpy(temp + length, ".tmp", 5);
+    FILE *fh = fopen(temp, "wb");
+    int result = fh &&
+                 fwrite(&header, sizeof(header), 1, fh) == 1 &&
+                 fwrite(&first, sizeof(first), 1, fh) == 1 &&
+                 fwrite(map->tree + 1, 1, used - sizeof(first), fh) == used - sizeof(first);
+    if (fh && fclose(fh))
+        result = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    result = result && MoveFileExA(temp, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    result = result && !rename(temp, path);
+#endif
+    if (!result)
+        remove(temp);
+    EZ_FREE(temp);
+    return result;
+}
+
+ezKeyMap* ezKeyMapMap(const char *path) {
+    void *base = NULL;
+    size_t size = 0;
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER length;
+    if (GetFileSizeEx(file, &length) && (uint64_t)length.QuadPart >= sizeof(KeyMapFileHeader) + sizeof(imap_node_t)) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping) {
+            base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        size = (size_t)length.QuadPart;
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (!fstat(fd, &st) && (uint64_t)st.st_size >= sizeof(KeyMapFileHeader) + sizeof(imap_node_t)) {
+        size = (size_t)st.st_size;
+        if ((base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+            base = NULL;
+    }
+    close(fd);
+#endif
+    if (!base)
+        return NULL;
+    // Only the header is checked, the tree itself is trusted
+    const KeyMapFileHeader *header = (const KeyMapFileHeader*)base;
+    imap_node_t *tree = (imap_node_t*)((uint8_t*)base + sizeof(KeyMapFileHeader));
+    if (memcmp(header->magic, KEYMAP_FILE_MAGIC, sizeof(header->magic)) ||
+        header->version != KEYMAP_FILE_VERSION ||
+        header->byteOrder != KEYMAP_FILE_BYTE_ORDER ||
+        header->slotBits != sizeof(tree->vec[0]) * 8 ||
+        header->headerSize != sizeof(KeyMapFileHeader) ||
+        header->treeSize < sizeof(imap_node_t) ||
+        header->treeSize > size - sizeof(KeyMapFileHeader) ||
+        header->valueSize > sizeof(imap_node_t) ||
+        tree->vec[imap__tree_size__] != header->treeSize) {
+        KeyMapUnmap(base, size);
+        return NULL;
+    }
+    ezKeyMap *map = EZ_MALLOC(sizeof(ezKeyMap));
+    map->tree = tree;
+    map->count = map->capacity = header->count;
+    map->mapped = size;
+    map->valueSize = header->valueSize;
+    map->strings = NULL;
+    map->filter = NULL;
+    return map;
+}
+
+static void DictArenaDestroy(ezDict *dict);
+
+void ezKeyMapDestroy(ezKeyMap *map) {
+    if (map->strings)
+        DictArenaDestroy(map);
+    if (map->filter)
+        ezBloomDestroy(map->filter);
+    if (map->mapped)
+        KeyMapUnmap((uint8_t*)map->tree - sizeof(KeyMapFileHeader), map->mapped);
+    else
+        imap__tree_free__(map->tree);
+    EZ_FREE(map);
+}
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define KEYMAP_THREAD_LOCAL __declspec(thread)
+// x86/x64 loads already have acquire semantics, only the compiler needs fencing
+static inline long KeyMapLoad(volatile long *p) {
+    long value = *p;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void* KeyMapLoadPtr(void *volatile *p) {
+    void *value = *p;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline uint32_t KeyMapLoad32(volatile uint32_t *p) {
+    return *p;
+}
+
+static inline uint64_t KeyMapLoad64(volatile uint64_t *p) {
+    return *p;
+}
+
+static inline void KeyMapStore(volatile long *p, long value) {
+    _ReadWriteBarrier();
+    *p = value;
+}
+
+static inline void KeyMapStorePtr(void *volatile *p, void *value) {
+    _ReadWriteBarrier();
+    *p = value;
+}
+
+static inline void KeyMapExchange(volatile long *p, long value) {
+    _InterlockedExchange(p, value);
+}
+
+static inline long KeyMapAdd(volatile long *p, long value) {
+    return _InterlockedExchangeAdd(p, value) + value;
+}
+
+static inline int KeyMapCas(volatile long *p, long expected, long desired) {
+    return _InterlockedCompareExchange(p, desired, expected) == expected;
+}
+
+static inline void KeyMapFence(void) {
+    _ReadWriteBarrier();
+}
+#else
+#if defined(__cplusplus)
+#define KEYMAP_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define KEYMAP_THREAD_LOCAL _Thread_local
+#else
+#define KEYMAP_THREAD_LOCAL __thread
+#endif
+static inline long KeyMapLoad(volatile long *p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void* KeyMapLoadPtr(void *volatile *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t KeyMapLoad32(volatile uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t KeyMapLoad64(volatile uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+static inline void KeyMapStore(volatile long *p, long value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline void KeyMapStorePtr(void *volatile *p, void *value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+static inline void KeyMapExchange(volatile long *p, long value) {
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline long KeyMapAdd(volatile long *p, long value) {
+    return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int KeyMapCas(volatile long *p, long expected, long desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline void KeyMapFence(void) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+#endif
+
+static inline imap_slot_t KeyMapLoadSlot(volatile imap_slot_t *p) {
+#if defined(EZMAP_LARGE)
+    return KeyMapLoad64(p);
+#else
+    return KeyMapLoad32(p);
+#endif
+}
+
+static inline void KeyMapPause(unsigned int *spins) {
+    if (++*spins < 64) {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+        _mm_pause();
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+        return;
+    }
+    *spins = 0;
+#if defined(_WIN32)
+    SwitchToThread();
+#else
+    sched_yield();
+#endif
+}
+
+struct ezKeyMapShard {
+    union {
+        struct {
+            volatile long sequence; // odd while a writer holds the shard
+            ezKeyMap map;
+        };
+        char line[64];
+    };
+};
+
+// Readers count themselves into the slot's counter for the current phase, a
+// writer flips the phase and waits for the old counters to drain before it frees
+// a replaced tree. Slots are per thread so readers don't share cache lines
+struct ezKeyMapReaderSlot {
+    union {
+        volatile long active[2];
+        char line[64];
+    };
+};
+
+static volatile long KeyMapReaderThreads;
+static KEYMAP_THREAD_LOCAL long KeyMapReaderIndex = -1;
+
+static inline ezKeyMapShard* KeyMapShardFor(ezConcurrentKeyMap *map, uint64_t key) {
+    return &map->shards[(uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (map->shardCount - 1)];
+}
+
+static ezKeyMapReaderSlot* KeyMapReaderEnter(ezConcurrentKeyMap *map, long *phase) {
+    if (KeyMapReaderIndex < 0)
+        KeyMapReaderIndex = KeyMapAdd(&KeyMapReaderThreads, 1) - 1;
+    ezKeyMapReaderSlot *slot = &map->readers[KeyMapReaderIndex & (EZMAP_READER_SLOTS - 1)];
+    for (;;) {
+        long p = KeyMapLoad(&map->phase);
+        KeyMapAdd(&slot->active[p], 1);
+        // The phase flipped in between, a writer may not have seen this reader
+        if (KeyMapLoad(&map->phase) == p) {
+            *phase = p;
+            return slot;
+        }
+        KeyMapAdd(&slot->active[p], -1);
+    }
+}
+
+static inline void KeyMapReaderExit(ezKeyMapReaderSlot *slot, long phase) {
+    KeyMapAdd(&slot->active[phase], -1);
+}
+
+// Frees `tree` once every reader that could have loaded it has finished
+static void KeyMapRetire(ezConcurrentKeyMap *map, imap_node_t *tree) {
+    unsigned int spins = 0;
+    while (!KeyMapCas(&map->reclaiming, 0, 1))
+        KeyMapPause(&spins);
+    long phase = KeyMapLoad(&map->phase);
+    KeyMapExchange(&map->phase, !phase);
+    for (size_t i = 0; i < EZMAP_READER_SLOTS; i++)
+        while (KeyMapLoad(&map->readers[i].active[phase]))
+            KeyMapPause(&spins);
+    KeyMapStore(&map->reclaiming, 0);
+    imap__tree_free__(tree);
+}
+
+static long KeyMapShardLock(ezKeyMapShard *shard) {
+    unsigned int spins = 0;
+    for (;;) {
+        long sequence = KeyMapLoad(&shard->sequence);
+        if (!(sequence & 1) && KeyMapCas(&shard->sequence, sequence, sequence + 1))
+            return sequence + 1;
+        KeyMapPause(&spins);
+    }
+}
+
+static inline void KeyMapShardUnlock(ezKeyMapShard *shard, long sequence) {
+    KeyMapStore(&shard->sequence, sequence + 1);
+}
+
+// imap_lookup for readers racing a writer. Nothing read can be trusted until
+// the shard's sequence is checked, so every offset is bounds checked against
+// the tree and the walk gives up after 16 levels (a torn read can form a cycle).
+// Returns 1 if found, 0 if not and -1 if the tree was inconsistent
+static int KeyMapRacyLookup(imap_node_t *tree, uint64_t x, uint64_t *value) {
+    uint64_t size = KeyMapLoadSlot(&tree->vec[imap__tree_size__]);
+    imap_slot_t sval = KeyMapLoadSlot(&tree->vec[imap__tree_root__]);
+    for (int depth = 0; depth <= 16; depth++) {
+        if (!(sval & imap__slot_node__))
+            return sval & imap__slot_value__ ? -1 : 0;
+        uint64_t offset = sval & imap__slot_value__;
+        if (offset + sizeof(imap_node_t) > size)
+            return -1;
+        imap_node_t *node = imap__node__(tree, offset);
+        uint32_t posn = KeyMapLoadSlot(&node->vec[0]) & 0xf;
+        sval = KeyMapLoadSlot(&node->vec[imap__xdir__(x, posn)]);
+        if (sval & imap__slot_node__)
+            continue;
+        if (!(sval & imap__slot_value__) || imap__node_prefix__(node) != (x & ~0xfull))
+            return 0;
+        if (imap__slot_boxed__(sval)) {
+            uint64_t index = sval >> imap__slot_shift__;
+            if ((index + 1) * sizeof(uint64_t) > size)
+                return -1;
+            *value = KeyMapLoad64(&tree->vec64[index]);
+        } else
+            *value = sval >> imap__slot_shift__;
+        return 1;
+    }
+    return -1;
+}
+
+ezConcurrentKeyMap* ezConcurrentKeyMapNew(size_t shards, size_t capacity) {
+    size_t count = 1;
+    while (count < (shards ? shards : EZMAP_DEFAULT_SHARDS))
+        count <<= 1;
+    if (capacity / count > EZMAP_DEFAULT_CAPACITY)
+        capacity /= count;
+    else
+        capacity = EZMAP_DEFAULT_CAPACITY;
+    ezConcurrentKeyMap *map = EZ_MALLOC(sizeof(ezConcurrentKeyMap));
+    if (!map)
+        return NULL;
+    map->shardCount = count;
+    map->phase = map->reclaiming = 0;
+    map->shards = (ezKeyMapShard*)IMAP_ALIGNED_ALLOC(sizeof(ezKeyMapShard), count * sizeof(ezKeyMapShard));
+    map->readers = (ezKeyMapReaderSlot*)IMAP_ALIGNED_ALLOC(sizeof(ezKeyMapReaderSlot), EZMAP_READER_SLOTS * sizeof(ezKeyMapReaderSlot));
+    if (!map->shards || !map->readers) {
+        IMAP_ALIGNED_FREE(map->shards);
+        IMAP_ALIGNED_FREE(map->readers);
+        EZ_FREE(map);
+        return NULL;
+    }
+    memset(map->shards, 0, count * sizeof(ezKeyMapShard));
+    memset(map->readers, 0, EZMAP_READER_SLOTS * sizeof(ezKeyMapReaderSlot));
+    for (size_t i = 0; i < count; i++) {
+        map->shards[i].map.capacity = capacity;
+        // Every shard needs a tree, lookups don't check for a missing one
+        if (!(map->shards[i].map.tree = imap_ensure(NULL, capacity))) {
+            ezConcurrentKeyMapDestroy(map);
+            return NULL;
+        }
+    }
+    return map;
+}
+
+int ezConcurrentKeyMapSet(ezConcurrentKeyMap *map, uint64_t key, void *value) {
+    ezKeyMapShard *shard = KeyMapShardFor(map, key);
+    imap_node_t *retired = NULL;
+    int result = 0;
+    long sequence = KeyMapShardLock(shard);
+    // Grow a copy so the new tree is only published once it has been filled in
+    ezKeyMap grown = shard->map;
+    if (KeyMapReserve(&grown, 1, &retired)) {
+        if (retired)
+            KeyMapStorePtr((void *volatile*)&shard->map.tree, grown.tree);
+        shard->map.capacity = grown.capacity;
+        imap_slot_t *slot = imap_assign(shard->map.tree, key);
+        if (!(*slot & imap__slot_value__))
+            shard->map.count++;
+        imap_setval(shard->map.tree, slot, (uint64_t)value);
+        result = 1;
+    }
+    KeyMapShardUnlock(shard, sequence);
+    if (retired)
+        KeyMapRetire(map, retired);
+    return result;
+}
+
+void* ezConcurrentKeyMapGet(ezConcurrentKeyMap *map, uint64_t key) {
+    ezKeyMapShard *shard = KeyMapShardFor(map, key);
+    uint64_t value = 0;
+    unsigned int spins = 0;
+    long phase;
+    ezKeyMapReaderSlot *reader = KeyMapReaderEnter(map, &phase);
+    for (;;) {
+        long sequence = KeyMapLoad(&shard->sequence);
+        if (sequence & 1) {
+            KeyMapPause(&spins);
+            continue;
+        }
+        int found = KeyMapRacyLookup((imap_node_t*)KeyMapLoadPtr((void *volatile*)&shard->map.tree), key, &value);
+        KeyMapFence();
+        if (found >= 0 && KeyMapLoad(&shard->sequence) == sequence) {
+            if (!found)
+                value = 0;
+            break;
+        }
+    }
+    KeyMapReaderExit(reader, phase);
+    return (void*)value;
+}
+
+void* ezConcurrentKeyMapDel(ezConcurrentKeyMap *map, uint64_t key) {
+    ezKeyMapShard *shard = KeyMapShardFor(map, key);
+    long sequence = KeyMapShardLock(shard);
+    void *result = ezKeyMapDel(&shard->map, key);
+    KeyMapShardUnlock(shard, sequence);
+    return result;
+}
+
+size_t ezConcurrentKeyMapCount(ezConcurrentKeyMap *map) {
+    size_t count = 0;
+    for (size_t i = 0; i < map->shardCount; i++)
+        count += map->shards[i].map.count;
+    return count;
+}
+
+void ezConcurrentKeyMapCompact(ezConcurrentKeyMap *map) {
+    for (size_t i = 0; i < map->shardCount; i++) {
+        ezKeyMapShard *shard = &map->shards[i];
+        imap_node_t *retired = NULL;
+        long sequence = KeyMapShardLock(shard);
+        ezKeyMap compacted = shard->map;
+        if (KeyMapCompact(&compacted, &retired)) {
+            KeyMapStorePtr((void *volatile*)&shard->map.tree, compacted.tree);
+            shard->map.capacity = compacted.capacity;
+        }
+        KeyMapShardUnlock(shard, sequence);
+        if (retired)
+            KeyMapRetire(map, retired);
+    }
+}
+
+#if defined(EZTHREADS_HEADER)
+// Each part is split into this many subtrees (at least) so parts that get
+// dense subtrees don't hold everyone else up
+#define KEYMAP_SUBTREES_PER_PART 16
+
+typedef struct {
+    ezKeyMap *map;
+    imap_node_t *tree;
+    imap_slot_t *subtrees;
+    size_t subtreeCount;
+    volatile long next, stop;
+    int(*callback)(ezKeyValuePair *pair, size_t part, void *userdata);
+    void *userdata;
+} KeyMapParallel;
+
+typedef struct {
+    KeyMapParallel *shared;
+    size_t part, visited;
+} KeyMapParallelJob;
+
+static int KeyMapWalkNode(KeyMapParallelJob *job, imap_slot_t offset) {
+    KeyMapParallel *shared = job->shared;
+    imap_node_t *node = imap__node__(shared->tree, offset);
+    ezKeyValuePair pair;
+    for (uint32_t dirn = 0; dirn < 16; dirn++) {
+        imap_slot_t sval = node->vec[dirn];
+        if (sval & imap__slot_node__) {
+            if (!KeyMapWalkNode(job, sval & imap__slot_value__))
+                return 0;
+        } else if (sval & imap__slot_value__) {
+            if (KeyMapLoad(&shared->stop))
+                return 0;
+            pair.key = (imap__node_prefix__(node) & ~0xfull) | dirn;
+            pair.val = KeyMapGetValue(shared->map, &node->vec[dirn]);
+            job->visited++;
+            if (!shared->callback(&pair, job->part, shared->userdata)) {
+                KeyMapStore(&shared->stop, 1);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void KeyMapParallelJobRun(void *arg) {
+    KeyMapParallelJob *job = (KeyMapParallelJob*)arg;
+    KeyMapParallel *shared = job->shared;
+    for (;;) {
+        size_t index = (size_t)KeyMapAdd(&shared->next, 1) - 1;
+        if (index >= shared->subtreeCount || !KeyMapWalkNode(job, shared->subtrees[index]))
+            break;
+    }
+}
+
+// Replaces every inner node in the list with its children, level by level, until
+// there are enough subtrees or only leaves are left. The list stays in key order,
+// NULL if it couldn't be allocated
+static imap_slot_t* KeyMapSplit(imap_node_t *tree, size_t target, size_t *count) {
+    imap_slot_t root = tree->vec[imap__tree_root__];
+    size_t n = 0;
+    imap_slot_t *subtrees = EZ_MALLOC(sizeof(imap_slot_t));
+    if (!subtrees)
+        return NULL;
+    if (root & imap__slot_node__)
+        subtrees[n++] = root & imap__slot_value__;
+    for (int split = 1; split && n && n < target;) {
+        size_t total = 0, m = 0;
+        for (size_t i = 0; i < n; i++) {
+            imap_node_t *node = imap__node__(tree, subtrees[i]);
+            total += imap__node_pos__(node) ? 16 : 1;
+        }
+        imap_slot_t *next = EZ_MALLOC(total * sizeof(imap_slot_t));
+        if (!next) {
+            EZ_FREE(subtrees);
+            return NULL;
+        }
+        split = 0;
+        for (size_t i = 0; i < n; i++) {
+            imap_node_t *node = imap__node__(tree, subtrees[i]);
+            if (!imap__node_pos__(node)) {
+                next[m++] = subtrees[i];
+                continue;
+            }
+            for (uint32_t dirn = 0; dirn < 16; dirn++)
+                if (node->vec[dirn] & imap__slot_node__)
+                    next[m++] = node->vec[dirn] & imap__slot_value__;
+            split = 1;
+        }
+        EZ_FREE(subtrees);
+        subtrees = next;
+        n = m;
+    }
+    *count = n;
+    return subtrees;
+}
+
+size_t ezKeyMapEachParallel(ezThreadPool *pool, ezKeyMap *map, size_t parts,
+                            int(*callback)(ezKeyValuePair *pair, size_t part, void *userdata),
+                            void(*reduce)(size_t part, void *userdata), void *userdata) {
+    if (!parts)
+        return 0;
+    KeyMapParallel shared;
+    shared.map = map;
+    shared.tree = map->tree;
+    shared.subtrees = KeyMapSplit(map->tree, parts * KEYMAP_SUBTREES_PER_PART, &shared.subtreeCount);
+    if (!shared.subtrees)
+        return 0;
+    shared.next = shared.stop = 0;
+    shared.callback = callback;
+    shared.userdata = userdata;
+    KeyMapParallelJob *jobs = EZ_MALLOC(parts * sizeof(KeyMapParallelJob));
+    if (!jobs) {
+        EZ_FREE(shared.subtrees);
+        return 0;
+    }
+    for (size_t i = 0; i < parts; i++) {
+        jobs[i].shared = &shared;
+        jobs[i].part = i;
+        jobs[i].visited = 0;
+        ezThreadPoolAddWork(pool, KeyMapParallelJobRun, &jobs[i]);
+    }
+    ezThreadPoolJoin(pool);
+    size_t visited = 0;
+    for (size_t i = 0; i < parts; i++) {
+        visited += jobs[i].visited;
+        if (reduce)
+            reduce(i, userdata);
+    }
+    EZ_FREE(jobs);
+    EZ_FREE(shared.subtrees);
+    return visited;
+}
+#endif
+
+void ezConcurrentKeyMapDestroy(ezConcurrentKeyMap *map) {
+    for (size_t i = 0; i < map->shardCount; i++)
+        imap__tree_free__(map->shards[i].map.tree);
+    IMAP_ALIGNED_FREE(map->shards);
+    IMAP_ALIGNED_FREE(map->readers);
+    EZ_FREE(map);
+}
+
+static inline uint64_t HashRead64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint64_t HashRead32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+static inline uint64_t HashRotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t HashSwap64(uint64_t x) {
+    x = ((x & 0x00FF00FF00FF00FFull) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFull);
+    x = ((x & 0x0000FFFF0000FFFFull) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFull);
+    return (x << 32) | (x >> 32);
+}
+
+// Full 64x64 -> 128 bit multiply, returns the low half and stores the high
+static inline uint64_t HashMul128(uint64_t a, uint64_t b, uint64_t *hi) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t al = a & 0xFFFFFFFF, ah = a >> 32;
+    uint64_t bl = b & 0xFFFFFFFF, bh = b >> 32;
+    uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return (mid << 32) | (ll & 0xFFFFFFFF);
+#endif
+}
+
+// Multiplies and folds the 128 bit product back into 64 bits
+static inline uint64_t HashFold(uint64_t a, uint64_t b) {
+    uint64_t hi, lo = HashMul128(a, b, &hi);
+    return lo ^ hi;
+}
+
+// wyhash (final version 4), keys up to 16 bytes are read with at most four
+// overlapping loads and no loop
+static const uint64_t WyHashSecret[4] = {
+    0x2D358DCCAA6C78A5ull, 0x8BB84B93962EACC9ull, 0x4B33A62ED433D4A3ull, 0x4D5A2DA51DE1AA47ull
+};
+
+static uint64_t WyHashLong(const uint8_t *p, size_t len, uint64_t seed) {
+    size_t i = len;
+    if (i >= 48) {
+        uint64_t see1 = seed, see2 = seed;
+        do {
+            seed = HashFold(HashRead64(p) ^ WyHashSecret[1], HashRead64(p + 8) ^ seed);
+            see1 = HashFold(HashRead64(p + 16) ^ WyHashSecret[2], HashRead64(p + 24) ^ see1);
+            see2 = HashFold(HashRead64(p + 32) ^ WyHashSecret[3], HashRead64(p + 40) ^ see2);
+            p += 48;
+            i -= 48;
+        } while (i >= 48);
+        seed ^= see1 ^ see2;
+    }
+    for (; i > 16; i -= 16, p += 16)
+        seed = HashFold(HashRead64(p) ^ WyHashSecret[1], HashRead64(p + 8) ^ seed);
+    uint64_t hi, lo = HashMul128(HashRead64(p + i - 16) ^ WyHashSecret[1], HashRead64(p + i - 8) ^ seed, &hi);
+    return HashFold(lo ^ WyHashSecret[0] ^ len, hi ^ WyHashSecret[1]);
+}
+
+uint64_t ezHashWy(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t*)data;
+    seed ^= HashFold(seed ^ WyHashSecret[0], WyHashSecret[1]);
+    if (len > 16)
+        return WyHashLong(p, len, seed);
+    uint64_t a = 0, b = 0;
+    if (len >= 4) {
+        size_t mid = (len >> 3) << 2;
+        a = (HashRead32(p) << 32) | HashRead32(p + mid);
+        b = (HashRead32(p + len - 4) << 32) | HashRead32(p + len - 4 - mid);
+    } else if (len)
+        a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+    uint64_t hi, lo = HashMul128(a ^ WyHashSecret[1], b ^ seed, &hi);
+    return HashFold(lo ^ WyHashSecret[0] ^ len, hi ^ WyHashSecret[1]);
+}
+
+// XXH3 (64-bit), inputs up to 240 bytes are mixed 16 bytes at a time, longer
+// inputs are accumulated in 64 byte stripes with SSE2 or AVX2
+#define XXH_PRIME32_1 0x9E3779B1u
+#define XXH_PRIME32_2 0x85EBCA77u
+#define XXH_PRIME32_3 0xC2B2AE3Du
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ull
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME64_3 0x165667B19E3779F9ull
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ull
+#define XXH_PRIME_MX1 0x165667919E3779F9ull
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ull
+#define XXH3_SECRET_SIZE 192
+#define XXH3_STRIPE_LEN 64
+#define XXH3_STRIPES_PER_BLOCK ((XXH3_SECRET_SIZE - XXH3_STRIPE_LEN) / 8)
+
+static const uint8_t XXH3Secret[XXH3_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+static inline uint64_t XXH64Avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t XXH3Avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t XXH3Mix16(const uint8_t *p, const uint8_t *secret, uint64_t seed) {
+    return HashFold(HashRead64(p) ^ (HashRead64(secret) + seed),
+                    HashRead64(p + 8) ^ (HashRead64(secret + 8) - seed));
+}
+
+// Every stripe adds its input to the neighbouring lane and the product of the
+// low and high halves of (input ^ secret) to its own lane, the secret moves 8
+// bytes per stripe
+static void XXH3Accumulate(uint64_t *acc, const uint8_t *p, const uint8_t *secret, size_t stripes) {
+#if defined(EZMAP_AVX2)
+    __m256i a0 = _mm256_loadu_si256((const __m256i*)acc);
+    __m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+    for (size_t n = 0; n < stripes; n++, p += XXH3_STRIPE_LEN, secret += 8) {
+        __m256i d0 = _mm256_loadu_si256((const __m256i*)p);
+        __m256i d1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+        __m256i k0 = _mm256_xor_si256(d0, _mm256_loadu_si256((const __m256i*)secret));
+        __m256i k1 = _mm256_xor_si256(d1, _mm256_loadu_si256((const __m256i*)(secret + 32)));
+        a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, _MM_SHUFFLE(1, 0, 3, 2)));
+        a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, _MM_SHUFFLE(1, 0, 3, 2)));
+        a0 = _mm256_add_epi64(a0, _mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1))));
+        a1 = _mm256_add_epi64(a1, _mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1))));
+    }
+    _mm256_storeu_si256((__m256i*)acc, a0);
+    _mm256_storeu_si256((__m256i*)(acc + 4), a1);
+#elif defined(EZMAP_SSE2)
+    __m128i a[4];
+    for (int i = 0; i < 4; i++)
+        a[i] = _mm_loadu_si128((const __m128i*)(acc + i * 2));
+    for (size_t n = 0; n < stripes; n++, p += XXH3_STRIPE_LEN, secret += 8)
+        for (int i = 0; i < 4; i++) {
+            __m128i d = _mm_loadu_si128((const __m128i*)(p + i * 16));
+            __m128i k = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(secret + i * 16)));
+            a[i] = _mm_add_epi64(a[i], _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2)));
+            a[i] = _mm_add_epi64(a[i], _mm_mul_epu32(k, _mm_shuffle_epi32(k, _MM_SHUFFLE(0, 3, 0, 1))));
+        }
+    for (int i = 0; i < 4; i++)
+        _mm_storeu_si128((__m128i*)(acc + i * 2), a[i]);
+#else
+    for (size_t n = 0; n < stripes; n++, p += XXH3_STRIPE_LEN, secret += 8)
+        for (int i = 0; i < 8; i++) {
+            uint64_t d = HashRead64(p + i * 8);
+            uint64_t k = d ^ HashRead64(secret + i * 8);
+            acc[i ^ 1] += d;
+            acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+        }
+#endif
+}
+
+static void XXH3Scramble(uint64_t *acc, const uint8_t *secret) {
+#if defined(EZMAP_AVX2)
+    const __m256i prime = _mm256_set1_epi32((int)XXH_PRIME32_1);
+    for (int i = 0; i < 2; i++) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(acc + i * 4));
+        a = _mm256_xor_si256(a, _mm256_srli_epi64(a, 47));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)(secret + i * 32)));
+        __m256i hi = _mm256_mul_epu32(_mm256_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        a = _mm256_add_epi64(_mm256_mul_epu32(a, prime), _mm256_slli_epi64(hi, 32));
+        _mm256_storeu_si256((__m256i*)(acc + i * 4), a);
+    }
+#elif defined(EZMAP_SSE2)
+    const __m128i prime = _mm_set1_epi32((int)XXH_PRIME32_1);
+    for (int i = 0; i < 4; i++) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(acc + i * 2));
+        a = _mm_xor_si128(a, _mm_srli_epi64(a, 47));
+        a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(secret + i * 16)));
+        __m128i hi = _mm_mul_epu32(_mm_shuffle_epi32(a, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+        a = _mm_add_epi64(_mm_mul_epu32(a, prime), _mm_slli_epi64(hi, 32));
+        _mm_storeu_si128((__m128i*)(acc + i * 2), a);
+    }
+#else
+    for (int i = 0; i < 8; i++) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= HashRead64(secret + i * 8);
+        acc[i] = a * XXH_PRIME32_1;
+    }
+#endif
+}
+
+static uint64_t XXH3Long(const uint8_t *p, size_t len, uint64_t seed) {
+    uint8_t custom[XXH3_SECRET_SIZE];
+    const uint8_t *secret = XXH3Secret;
+    if (seed) {
+        // Seeded hashes use a secret derived from the default one
+        for (int i = 0; i < XXH3_SECRET_SIZE; i += 16) {
+            uint64_t lo = HashRead64(XXH3Secret + i) + seed;
+            uint64_t hi = HashRead64(XXH3Secret + i + 8) - seed;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            lo = __builtin_bswap64(lo);
+            hi = __builtin_bswap64(hi);
+#endif
+            memcpy(custom + i, &lo, 8);
+            memcpy(custom + i + 8, &hi, 8);
+        }
+        secret = custom;
+    }
+    uint64_t acc[8] = {
+        XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+        XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+    };
+    size_t block = XXH3_STRIPE_LEN * XXH3_STRIPES_PER_BLOCK;
+    size_t blocks = (len - 1) / block;
+    for (size_t n = 0; n < blocks; n++) {
+        XXH3Accumulate(acc, p + n * block, secret, XXH3_STRIPES_PER_BLOCK);
+        XXH3Scramble(acc, secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN);
+    }
+    XXH3Accumulate(acc, p + blocks * block, secret, ((len - 1) - block * blocks) / XXH3_STRIPE_LEN);
+    XXH3Accumulate(acc, p + len - XXH3_STRIPE_LEN, secret + XXH3_SECRET_SIZE - XXH3_STRIPE_LEN - 7, 1);
+    uint64_t result = len * XXH_PRIME64_1;
+    for (int i = 0; i < 4; i++)
+        result += HashFold(acc[i * 2] ^ HashRead64(secret + 11 + i * 16),
+                           acc[i * 2 + 1] ^ HashRead64(secret + 11 + i * 16 + 8));
+    return XXH3Avalanche(result);
+}
+
+static uint64_t XXH3Medium(const uint8_t *p, size_t len, uint64_t seed) {
+    const uint8_t *secret = XXH3Secret;
+    uint64_t acc = len * XXH_PRIME64_1;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += XXH3Mix16(p + 48, secret + 96, seed);
+                    acc += XXH3Mix16(p + len - 64, secret + 112, seed);
+                }
+                acc += XXH3Mix16(p + 32, secret + 64, seed);
+                acc += XXH3Mix16(p + len - 48, secret + 80, seed);
+            }
+            acc += XXH3Mix16(p + 16, secret + 32, seed);
+            acc += XXH3Mix16(p + len - 32, secret + 48, seed);
+        }
+        acc += XXH3Mix16(p, secret, seed);
+        acc += XXH3Mix16(p + len - 16, secret + 16, seed);
+        return XXH3Avalanche(acc);
+    }
+    size_t rounds = len / 16;
+    for (size_t i = 0; i < 8; i++)
+        acc += XXH3Mix16(p + i * 16, secret + i * 16, seed);
+    acc = XXH3Avalanche(acc);
+    for (size_t i = 8; i < rounds; i++)
+        acc += XXH3Mix16(p + i * 16, secret + (i - 8) * 16 + 3, seed);
+    acc += XXH3Mix16(p + len - 16, secret + 136 - 17, seed);
+    return XXH3Avalanche(acc);
+}
+
+uint64_t ezHashXXH3(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t*)data;
+    const uint8_t *secret = XXH3Secret;
+    if (len > 240)
+        return XXH3Long(p, len, seed);
+    if (len > 16)
+        return XXH3Medium(p, len, seed);
+    if (len > 8) {
+        uint64_t lo = HashRead64(p) ^ ((HashRead64(secret + 24) ^ HashRead64(secret + 32)) + seed);
+        uint64_t hi = HashRead64(p + len - 8) ^ ((HashRead64(secret + 40) ^ HashRead64(secret + 48)) - seed);
+        return XXH3Avalanche(len + HashSwap64(lo) + hi + HashFold(lo, hi));
+    }
+    if (len >= 4) {
+        seed ^= (HashSwap64(seed) >> 32) << 32;
+        uint64_t x = (HashRead32(p + len - 4) + (HashRead32(p) << 32)) ^ ((HashRead64(secret + 8) ^ HashRead64(secret + 16)) - seed);
+        x ^= HashRotl64(x, 49) ^ HashRotl64(x, 24);
+        x *= XXH_PRIME_MX2;
+        x ^= (x >> 35) + len;
+        x *= XXH_PRIME_MX2;
+        return x ^ (x >> 28);
+    }
+    if (len) {
+        uint32_t combined = ((uint32_t)p[0] << 16) | ((uint32_t)p[len >> 1] << 24) | p[len - 1] | ((uint32_t)len << 8);
+        return XXH64Avalanche(combined ^ ((HashRead32(secret) ^ HashRead32(secret + 4)) + seed));
+    }
+    return XXH64Avalanche(seed ^ HashRead64(secret + 56) ^ HashRead64(secret + 64));
+}
+
+// MurmurHash3 (x64, 128-bit), the first half of the result is returned
+static inline uint64_t MurmurMix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xFF51AFD7ED558CCDull;
+    k ^= k >> 33;
+    k *= 0xC4CEB9FE1A85EC53ull;
+    return k ^ (k >> 33);
+}
+
+uint64_t MurmurHash(const void *data, size_t len, uint32_t seed) {
+    const uint8_t *p = (const uint8_t*)data;
+    const uint64_t c1 = 0x87C37B91114253D5ull, c2 = 0x4CF5AD432745937Full;
+    uint64_t h1 = seed, h2 = seed;
+    for (size_t n = len / 16; n; n--, p += 16) {
+        uint64_t k1 = HashRead64(p), k2 = HashRead64(p + 8);
+        h1 ^= HashRotl64(k1 * c1, 31) * c2;
+        h1 = (HashRotl64(h1, 27) + h2) * 5 + 0x52DCE729;
+        h2 ^= HashRotl64(k2 * c2, 33) * c1;
+        h2 = (HashRotl64(h2, 31) + h1) * 5 + 0x38495AB5;
+    }
+    uint64_t k1 = 0, k2 = 0;
+    size_t tail = len & 15;
+    for (size_t i = tail; i > 8; i--)
+        k2 |= (uint64_t)p[i - 1] << ((i - 9) * 8);
+    for (size_t i = tail < 8 ? tail : 8; i; i--)
+        k1 |= (uint64_t)p[i - 1] << ((i - 1) * 8);
+    if (tail > 8)
+        h2 ^= HashRotl64(k2 * c2, 33) * c1;
+    if (tail)
+        h1 ^= HashRotl64(k1 * c1, 31) * c2;
+    h1 ^= len;
+    h2 ^= len;
+    h1 += h2;
+    h2 += h1;
+    h1 = MurmurMix(h1);
+    h2 = MurmurMix(h2);
+    return h1 + h2;
+}
+
+uint64_t ezHash(const void *data, size_t length, uint64_t seed) {
+#if defined(EZMAP_USE_XXH3)
+    return ezHashXXH3(data, length, seed);
+#elif defined(EZMAP_USE_MURMUR)
+    return MurmurHash(data, length, (uint32_t)(seed ^ (seed >> 32)));
+#else
+    return ezHashWy(data, length, seed);
+#endif
+}
+
+// Control bytes are 0x80 for an empty slot or the low 7 bits of the key's hash,
+// the rest of the hash picks the slot probing starts from. Probing is linear,
+// 16 slots at a time, so a key is always before the first empty slot after its
+// home slot. That lets deletes shift keys back instead of leaving tombstones
+#define FLATMAP_GROUP 16
+#define FLATMAP_EMPTY 0x80
+
+static inline uint64_t FlatMapHash(uint64_t key) {
+    return HashFold(key ^ WyHashSecret[0], WyHashSecret[1]);
+}
+
+static inline uint32_t FlatMapCtz(uint32_t x) {
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return (uint32_t)i;
+#else
+    return (uint32_t)__builtin_ctz(x);
+#endif
+}
+
+// Bit i is set if control byte i of the group equals `tag`
+static inline uint32_t FlatMapMatch(const uint8_t *group, uint8_t tag) {
+#if defined(EZMAP_SSE2)
+    __m128i g = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < FLATMAP_GROUP; i++)
+        bits |= (uint32_t)(group[i] == tag) << i;
+    return bits;
+#endif
+}
+
+static inline uint32_t FlatMapMatchEmpty(const uint8_t *group) {
+#if defined(EZMAP_SSE2)
+    // Empty is the only control byte with the top bit set
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    return FlatMapMatch(group, FLATMAP_EMPTY);
+#endif
+}
+
+static inline void FlatMapSetControl(ezFlatMap *map, size_t i, uint8_t tag) {
+    map->control[i] = tag;
+    if (i < FLATMAP_GROUP)
+        map->control[map->capacity + i] = tag;
+}
+
+static inline size_t FlatMapFind(ezFlatMap *map, uint64_t key, uint64_t hash) {
+    size_t mask = map->capacity - 1, pos = (hash >> 7) & mask;
+    for (;;) {
+        const uint8_t *group = map->control + pos;
+        for (uint32_t bits = FlatMapMatch(group, hash & 0x7F); bits; bits &= bits - 1) {
+            size_t i = (pos + FlatMapCtz(bits)) & mask;
+            if (map->slots[i].key == key)
+                return i;
+        }
+        if (FlatMapMatchEmpty(group))
+            return SIZE_MAX;
+        pos = (pos + FLATMAP_GROUP) & mask;
+    }
+}
+
+static inline size_t FlatMapFindEmpty(ezFlatMap *map, uint64_t hash) {
+    size_t mask = map->capacity - 1, pos = (hash >> 7) & mask;
+    for (;;) {
+        uint32_t bits = FlatMapMatchEmpty(map->control + pos);
+        if (bits)
+            return (pos + FlatMapCtz(bits)) & mask;
+        pos = (pos + FLATMAP_GROUP) & mask;
+    }
+}
+
+static int FlatMapResize(ezFlatMap *map, size_t capacity) {
+    ezKeyValuePair *slots = EZ_MALLOC(capacity * sizeof(ezKeyValuePair) + capacity + FLATMAP_GROUP);
+    if (!slots)
+        return 0;
+    ezFlatMap old = *map;
+    map->slots = slots;
+    map->control = (uint8_t*)(slots + capacity);
+    map->capacity = capacity;
+    map->growth = capacity - capacity / 8 - map->count;
+    memset(map->control, FLATMAP_EMPTY, capacity + FLATMAP_GROUP);
+    for (size_t i = 0; i < old.capacity; i++)
+        if (!(old.control[i] & FLATMAP_EMPTY)) {
+            uint64_t hash = FlatMapHash(old.slots[i].key);
+            size_t j = FlatMapFindEmpty(map, hash);
+            FlatMapSetControl(map, j, hash & 0x7F);
+            map->slots[j] = old.slots[i];
+        }
+    EZ_FREE(old.slots);
+    return 1;
+}
+
+// Tables are kept at most 7/8 full
+static inline size_t FlatMapCapacity(size_t count) {
+    size_t capacity = imap__ceilpow2__(count + count / 7 + 1);
+    return capacity < FLATMAP_GROUP ? FLATMAP_GROUP : capacity;
+}
+
+ezFlatMap* ezFlatMapNew(size_t capacity) {
+    ezFlatMap *result = EZ_MALLOC(sizeof(ezFlatMap));
+    if (!result)
+        return NULL;
+    memset(result, 0, sizeof(ezFlatMap));
+    if (!FlatMapResize(result, FlatMapCapacity(capacity ? capacity : EZMAP_DEFAULT_CAPACITY))) {
+        EZ_FREE(result);
+        return NULL;
+    }
+    return result;
+}
+
+int ezFlatMapReserve(ezFlatMap *map, size_t capacity) {
+    if (capacity <= map->count + map->growth)
+        return 1;
+    return FlatMapResize(map, FlatMapCapacity(capacity));
+}
+
+int ezFlatMapSet(ezFlatMap *map, uint64_t key, void *value) {
+    uint64_t hash = FlatMapHash(key);
+    size_t i = FlatMapFind(map, key, hash);
+    if (i != SIZE_MAX) {
+        map->slots[i].val = value;
+        return 1;
+    }
+    if (!map->growth && !FlatMapResize(map, map->capacity * 2))
+        return 0;
+    i = FlatMapFindEmpty(map, hash);
+    FlatMapSetControl(map, i, hash & 0x7F);
+    map->slots[i].key = key;
+    map->slots[i].val = value;
+    map->count++;
+    map->growth--;
+    return 1;
+}
+
+void* ezFlatMapGet(ezFlatMap *map, uint64_t key) {
+    size_t i = FlatMapFind(map, key, FlatMapHash(key));
+    return i == SIZE_MAX ? NULL : map->slots[i].val;
+}
+
+void* ezFlatMapDel(ezFlatMap *map, uint64_t key) {
+    size_t i = FlatMapFind(map, key, FlatMapHash(key));
+    if (i == SIZE_MAX)
+        return NULL;
+    void *value = map->slots[i].val;
+    size_t mask = map->capacity - 1;
+    // Pull back any key after the hole that is allowed to sit in it, that is
+    // whose home slot isn't between the hole and where the key is now
+    for (size_t j = (i + 1) & mask; !(map->control[j] & FLATMAP_EMPTY); j = (j + 1) & mask) {
+        size_t home = (FlatMapHash(map->slots[j].key) >> 7) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map->slots[i] = map->slots[j];
+            FlatMapSetControl(map, i, map->control[j]);
+            i = j;
+        }
+    }
+    FlatMapSetControl(map, i, FLATMAP_EMPTY);
+    map->count--;
+    map->growth++;
+    return value;
+}
+
+int ezFlatMapEach(ezFlatMap *map, int(*callback)(ezKeyValuePair *pair, uint64_t, void*), void *userdata) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < map->capacity; i++)
+        if (!(map->control[i] & FLATMAP_EMPTY)) {
+            int result = callback(&map->slots[i], n++, userdata);
+            if (!result)
+                return result;
+        }
+    return 0;
+}
+
+void ezFlatMapDestroy(ezFlatMap *map) {
+    EZ_FREE(map->slots);
+    EZ_FREE(map);
+}
+
+struct ezCacheEntry {
+    uint64_t key;
+    void *value;
+};
+
+// Each entry has a flag byte, kept apart from the entries so the hand sweeps
+// through a dense array. Freed entries are chained through their value
+#define CACHE_USED 1
+#define CACHE_REFERENCED 2
+
+ezCache* ezCacheNew(size_t capacity, void(*evict)(uint64_t key, void *value, void *userdata), void *userdata) {
+    if (!capacity)
+        capacity = EZMAP_DEFAULT_CAPACITY;
+    ezCache *cache = EZ_MALLOC(sizeof(ezCache));
+    if (!cache)
+        return NULL;
+    memset(cache, 0, sizeof(ezCache));
+    cache->index = ezFlatMapNew(capacity);
+    cache->entries = EZ_MALLOC(capacity * sizeof(ezCacheEntry));
+    cache->flags = EZ_MALLOC(capacity);
+    if (!cache->index || !cache->entries || !cache->flags) {
+        if (cache->index)
+            ezFlatMapDestroy(cache->index);
+        EZ_FREE(cache->entries);
+        EZ_FREE(cache->flags);
+        EZ_FREE(cache);
+        return NULL;
+    }
+    memset(cache->flags, 0, capacity);
+    cache->capacity = capacity;
+    cache->evict = evict;
+    cache->userdata = userdata;
+    return cache;
+}
+
+static inline size_t CacheFind(ezCache *cache, uint64_t key) {
+    size_t i = FlatMapFind(cache->index, key, FlatMapHash(key));
+    return i == SIZE_MAX ? SIZE_MAX : (size_t)(uintptr_t)cache->index->slots[i].val;
+}
+
+void* ezCacheGet(ezCache *cache, uint64_t key) {
+    size_t i = CacheFind(cache, key);
+    if (i == SIZE_MAX) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    cache->flags[i] |= CACHE_REFERENCED;
+    return cache->entries[i].value;
+}
+
+void* ezCachePeek(ezCache *cache, uint64_t key) {
+    size_t i = CacheFind(cache, key);
+    return i == SIZE_MAX ? NULL : cache->entries[i].value;
+}
+
+// Sweeps until an unreferenced entry comes up, at most one full turn clearing
+// bits and then the first entry the hand started on
+static size_t CacheEvict(ezCache *cache) {
+    for (;;) {
+        size_t i = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+        if (!(cache->flags[i] & CACHE_USED))
+            continue;
+        if (cache->flags[i] & CACHE_REFERENCED) {
+            cache->flags[i] &= ~CACHE_REFERENCED;
+            continue;
+        }
+        ezCacheEntry *entry = &cache->entries[i];
+        ezFlatMapDel(cache->index, entry->key);
+        cache->flags[i] = 0;
+        cache->count--;
+        cache->evictions++;
+        if (cache->evict)
+            cache->evict(entry->key, entry->value, cache->userdata);
+        return i;
+    }
+}
+
+int ezCachePut(ezCache *cache, uint64_t key, void *value) {
+    size_t i = CacheFind(cache, key);
+    if (i != SIZE_MAX) {
+        ezCacheEntry *entry = &cache->entries[i];
+        void *old = entry->value;
+        entry->value = value;
+        if (cache->evict && old != value)
+            cache->evict(key, old, cache->userdata);
+        return 1;
+    }
+    if (cache->count == cache->capacity)
+        i = CacheEvict(cache);
+    else if (cache->freed) {
+        i = cache->freed - 1;
+        cache->freed = (size_t)(uintptr_t)cache->entries[i].value;
+    } else
+        i = cache->count;
+    if (!ezFlatMapSet(cache->index, key, (void*)(uintptr_t)i))
+        return 0;
+    cache->entries[i].key = key;
+    cache->entries[i].value = value;
+    cache->flags[i] = CACHE_USED;
+    cache->count++;
+    return 1;
+}
+
+void* ezCacheDel(ezCache *cache, uint64_t key) {
+    size_t i = CacheFind(cache, key);
+    if (i == SIZE_MAX)
+        return NULL;
+    void *value = cache->entries[i].value;
+    ezFlatMapDel(cache->index, key);
+    cache->flags[i] = 0;
+    cache->entries[i].value = (void*)(uintptr_t)cache->freed;
+    cache->freed = i + 1;
+    cache->count--;
+    return value;
+}
+
+void ezCacheClear(ezCache *cache) {
+    for (size_t i = 0; i < cache->capacity; i++)
+        if (cache->flags[i] & CACHE_USED) {
+            ezFlatMapDel(cache->index, cache->entries[i].key);
+            if (cache->evict)
+                cache->evict(cache->entries[i].key, cache->entries[i].value, cache->userdata);
+        }
+    memset(cache->flags, 0, cache->capacity);
+    cache->count = cache->hand = cache->freed = 0;
+}
+
+void ezCacheDestroy(ezCache *cache) {
+    if (cache->evict)
+        for (size_t i = 0; i < cache->capacity; i++)
+            if (cache->flags[i] & CACHE_USED)
+                cache->evict(cache->entries[i].key, cache->entries[i].value, cache->userdata);
+    ezFlatMapDestroy(cache->index);
+    EZ_FREE(cache->entries);
+    EZ_FREE(cache->flags);
+    EZ_FREE(cache);
+}
+
+// A key's hash picks the block with its high half (scaled to the block count,
+// so it needn't be a power of two), the low half is multiplied by a different
+// odd constant for each word and the top 6 bits of that pick the bit
+static const uint32_t BloomSalt[8] = {
+    0x47B6137Bu, 0x44974D91u, 0x8824AD5Bu, 0xA2B7289Du, 0x705495C7u, 0x2DF1424Bu, 0x9EFC4947u, 0x5C6BFB31u
+};
+
+static inline uint64_t* BloomBlock(ezBloom *bloom, uint64_t hash) {
+    return bloom->blocks + (((hash >> 32) * bloom->blockCount) >> 32) * 8;
+}
+
+// Sizing only needs a few digits, these keep libm out of the link
+static double BloomSqrt(double x) {
+    double root = 1.0, next;
+    while ((next = .5 * (root + x / root)) < root)
+        root = next;
+    return root;
+}
+
+// ln(x) for x in (0, 1], scaled into [0.5, 1) then 2*atanh((x-1)/(x+1))
+static double BloomLog(double x) {
+    int exponent = 0;
+    while (x < .5) {
+        x *= 2.0;
+        exponent++;
+    }
+    double z = (x - 1.0) / (x + 1.0), z2 = z * z, term = z, sum = 0;
+    for (int i = 1; term * term > 1e-34; i += 2) {
+        sum += term / i;
+        term *= z2;
+    }
+    return 2.0 * sum - exponent * 0.69314718055994530942;
+}
+
+ezBloom* ezBloomNew(size_t capacity, double falsePositiveRate) {
+    if (falsePositiveRate <= 0 || falsePositiveRate >= 1)
+        falsePositiveRate = EZMAP_BLOOM_RATE;
+    if (!capacity)
+        capacity = EZMAP_DEFAULT_CAPACITY;
+    // Bits per key for 8 hashes, the extra 10% makes up for keys not being spread
+    // evenly between blocks
+    double bits = -8.0 / BloomLog(1.0 - BloomSqrt(BloomSqrt(BloomSqrt(falsePositiveRate)))) * 1.1;
+    ezBloom *bloom = EZ_MALLOC(sizeof(ezBloom));
+    if (!bloom)
+        return NULL;
+    bloom->blockCount = (size_t)(capacity * bits / 512.0) + 1;
+    bloom->blocks = IMAP_ALIGNED_ALLOC(64, bloom->blockCount * 64);
+    if (!bloom->blocks) {
+        EZ_FREE(bloom);
+        return NULL;
+    }
+    bloom->capacity = capacity;
+    bloom->falsePositiveRate = falsePositiveRate;
+    ezBloomClear(bloom);
+    return bloom;
+}
+
+void ezBloomAdd(ezBloom *bloom, uint64_t key) {
+    uint64_t hash = FlatMapHash(key);
+    uint64_t *block = BloomBlock(bloom, hash);
+    for (int i = 0; i < 8; i++)
+        block[i] |= 1ull << (((uint32_t)hash * BloomSalt[i]) >> 26);
+    bloom->count++;
+}
+
+int ezBloomHas(ezBloom *bloom, uint64_t key) {
+    uint64_t hash = FlatMapHash(key);
+    const uint64_t *block = BloomBlock(bloom, hash);
+#if defined(EZMAP_AVX2)
+    __m256i bit = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32((int)(uint32_t)hash),
+                                                       _mm256_loadu_si256((const __m256i*)BloomSalt)), 26);
+    const __m256i one = _mm256_set1_epi64x(1);
+    __m256i lo = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bit)));
+    __m256i hi = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bit, 1)));
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i*)block), lo) &
+           _mm256_testc_si256(_mm256_load_si256((const __m256i*)(block + 4)), hi);
+#else
+    uint64_t missing = 0;
+    for (int i = 0; i < 8; i++)
+        missing |= ~block[i] & (1ull << (((uint32_t)hash * BloomSalt[i]) >> 26));
+    return !missing;
+#endif
+}
+
+void ezBloomAddBytes(ezBloom *bloom, const void *data, size_t length) {
+    ezBloomAdd(bloom, ezHash(data, length, EZMAP_HASH_SEED));
+}
+
+int ezBloomHasBytes(ezBloom *bloom, const void *data, size_t length) {
+    return ezBloomHas(bloom, ezHash(data, length, EZMAP_HASH_SEED));
+}
+
+void ezBloomClear(ezBloom *bloom) {
+    memset(bloom->blocks, 0, bloom->blockCount * 64);
+    bloom->count = 0;
+}
+
+void ezBloomDestroy(ezBloom *bloom) {
+    IMAP_ALIGNED_FREE(bloom->blocks);
+    EZ_FREE(bloom);
+}
+
+// Filters are sized for twice the keys in the map, so rebuilds as it grows cost
+// a constant amount per key
+static int KeyMapFilterBuild(ezKeyMap *map, double falsePositiveRate) {
+    size_t capacity = map->count * 2 > EZMAP_DEFAULT_CAPACITY ? map->count * 2 : EZMAP_DEFAULT_CAPACITY;
+    ezBloom *filter = ezBloomNew(capacity, falsePositiveRate);
+    if (!filter)
+        return 0;
+    imap_iter_t iter;
+    for (imap_pair_t pair = imap_iterate(map->tree, &iter, 1); pair.slot; pair = imap_iterate(map->tree, &iter, 0))
+        ezBloomAdd(filter, pair.x);
+    if (map->filter)
+        ezBloomDestroy(map->filter);
+    map->filter = filter;
+    return 1;
+}
+
+// The key's slot has no value yet so a rebuild won't see it, it is always added
+// after. If the rebuild fails the old filter is kept, it is still correct but
+// less selective
+static void KeyMapFilterAdd(ezKeyMap *map, uint64_t key) {
+    if (map->filter->count >= map->filter->capacity)
+        KeyMapFilterBuild(map, map->filter->falsePositiveRate);
+    ezBloomAdd(map->filter, key);
+}
+
+int ezKeyMapAddFilter(ezKeyMap *map, double falsePositiveRate) {
+    return KeyMapFilterBuild(map, falsePositiveRate);
+}
+
+void ezKeyMapRemoveFilter(ezKeyMap *map) {
+    if (map->filter)
+        ezBloomDestroy(map->filter);
+    map->filter = NULL;
+}
+
+// Adaptive radix tree, inner nodes hold 4, 16, 48 or 256 children and grow or
+// shrink between those sizes. Runs of single child nodes are collapsed into a
+// prefix on the node below, only the first STRINGMAP_MAX_PREFIX bytes of it are
+// kept, the rest are checked against the full key in the leaf. Keys are stored
+// with their terminating NUL so no key is the prefix of another
+#define STRINGMAP_MAX_PREFIX 10
+
+enum {
+    STRINGMAP_NODE4 = 1,
+    STRINGMAP_NODE16,
+    STRINGMAP_NODE48,
+    STRINGMAP_NODE256
+};
+
+typedef struct {
+    uint8_t type;
+    uint16_t count;
+    uint32_t prefixLength;
+    uint8_t prefix[STRINGMAP_MAX_PREFIX];
+} StringNode;
+
+typedef struct {
+    StringNode node;
+    uint8_t keys[4];
+    void *children[4];
+} StringNode4;
+
+typedef struct {
+    StringNode node;
+    uint8_t keys[16];
+    void *children[16];
+} StringNode16;
+
+// `index` holds the position in `children` + 1, or 0 if there is no child
+typedef struct {
+    StringNode node;
+    uint8_t index[256];
+    void *children[48];
+} StringNode48;
+
+typedef struct {
+    StringNode node;
+    void *children[256];
+} StringNode256;
+
+// Leaves are tagged by the low bit of the child pointer
+typedef struct {
+    void *value;
+    size_t length; // including the NUL
+    char key[];
+} StringLeaf;
+
+#define STRINGMAP_IS_LEAF(p) ((uintptr_t)(p) & 1)
+#define STRINGMAP_LEAF(p) ((StringLeaf*)((uintptr_t)(p) & ~(uintptr_t)1))
+#define STRINGMAP_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static StringNode* StringMapNodeNew(uint8_t type) {
+    static const size_t sizes[] = {
+        0, sizeof(StringNode4), sizeof(StringNode16), sizeof(StringNode48), sizeof(StringNode256)
+    };
+    StringNode *node = EZ_MALLOC(sizes[type]);
+    if (node) {
+        memset(node, 0, sizes[type]);
+        node->type = type;
+    }
+    return node;
+}
+
+static void* StringMapLeafNew(const char *key, size_t length, void *value) {
+    StringLeaf *leaf = EZ_MALLOC(sizeof(StringLeaf) + length);
+    if (!leaf)
+        return NULL;
+    leaf->value = value;
+    leaf->length = length;
+    memcpy(leaf->key, key, length);
+    return (void*)((uintptr_t)leaf | 1);
+}
+
+static inline int StringMapLeafMatches(StringLeaf *leaf, const char *key, size_t length) {
+    return leaf->length == length && !memcmp(leaf->key, key, length);
+}
+
+static void** StringMapFindChild(StringNode *node, uint8_t c) {
+    switch (node->type) {
+        case STRINGMAP_NODE4: {
+            StringNode4 *n = (StringNode4*)node;
+            for (int i = 0; i < node->count; i++)
+                if (n->keys[i] == c)
+                    return &n->children[i];
+            return NULL;
+        }
+        case STRINGMAP_NODE16: {
+            StringNode16 *n = (StringNode16*)node;
+#if defined(EZMAP_SSE2)
+            __m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8((char)c), _mm_loadu_si128((const __m128i*)n->keys));
+            uint32_t bits = (uint32_t)_mm_movemask_epi8(cmp) & ((1u << node->count) - 1);
+            return bits ? &n->children[FlatMapCtz(bits)] : NULL;
+#else
+            for (int i = 0; i < node->count; i++)
+                if (n->keys[i] == c)
+                    return &n->children[i];
+            return NULL;
+#endif
+        }
+        case STRINGMAP_NODE48: {
+            StringNode48 *n = (StringNode48*)node;
+            return n->index[c] ? &n->children[n->index[c] - 1] : NULL;
+        }
+        default: {
+            StringNode256 *n = (StringNode256*)node;
+            return n->children[c] ? &n->children[c] : NULL;
+        }
+    }
+}
+
+static StringLeaf* StringMapMinimum(void *node) {
+    while (node && !STRINGMAP_IS_LEAF(node)) {
+        StringNode *n = (StringNode*)node;
+        switch (n->type) {
+            case STRINGMAP_NODE4:
+                node = ((StringNode4*)n)->children[0];
+                break;
+            case STRINGMAP_NODE16:
+                node = ((StringNode16*)n)->children[0];
+                break;
+            case STRINGMAP_NODE48: {
+                StringNode48 *n48 = (StringNode48*)n;
+                int i = 0;
+                while (!n48->index[i])
+                    i++;
+                node = n48->children[n48->index[i] - 1];
+                break;
+            }
+            default: {
+                StringNode256 *n256 = (StringNode256*)n;
+                int i = 0;
+                while (!n256->children[i])
+                    i++;
+                node = n256->children[i];
+                break;
+            }
+        }
+    }
+    return node ? STRINGMAP_LEAF(node) : NULL;
+}
+
+// Number of bytes of the node's prefix that match `key` from `depth`, bytes past
+// those kept in the node are compared against a leaf below it
+static size_t StringMapPrefixMismatch(StringNode *node, const char *key, size_t length, size_t depth) {
+    size_t max = STRINGMAP_MIN(STRINGMAP_MIN(node->prefixLength, STRINGMAP_MAX_PREFIX), length - depth);
+    size_t i = 0;
+    for (; i < max; i++)
+        if (node->prefix[i] != (uint8_t)key[depth + i])
+            return i;
+    if (node->prefixLength > STRINGMAP_MAX_PREFIX) {
+        StringLeaf *leaf = StringMapMinimum(node);
+        max = STRINGMAP_MIN(STRINGMAP_MIN(leaf->length, length) - depth, node->prefixLength);
+        for (; i < max; i++)
+            if (leaf->key[depth + i] != key[depth + i])
+                return i;
+    }
+    return i;
+}
+
+// Only the prefix bytes kept in the node are checked, lookups compare the whole
+// key once they reach a leaf
+static inline int StringMapCheckPrefix(StringNode *node, const char *key, size_t length, size_t depth) {
+    size_t kept = STRINGMAP_MIN(node->prefixLength, STRINGMAP_MAX_PREFIX);
+    return length - depth > kept && !memcmp(node->prefix, key + depth, kept);
+}
+
+// Adding a child can replace the node with a bigger one, the add functions
+// return 0 if that couldn't be allocated (nothing is changed)
+static int StringMapAddChild256(StringNode256 *node, uint8_t c, void *child) {
+    node->node.count++;
+    node->children[c] = child;
+    return 1;
+}
+
+static int StringMapAddChild48(StringNode48 *node, void **ref, uint8_t c, void *child) {
+    if (node->node.count < 48) {
+        int pos = 0;
+        while (node->children[pos])
+            pos++;
+        node->children[pos] = child;
+        node->index[c] = pos + 1;
+        node->node.count++;
+        return 1;
+    }
+    StringNode256 *grown = (StringNode256*)StringMapNodeNew(STRINGMAP_NODE256);
+    if (!grown)
+        return 0;
+    for (int i = 0; i < 256; i++)
+        if (node->index[i])
+            grown->children[i] = node->children[node->index[i] - 1];
+    memcpy(&grown->node, &node->node, sizeof(StringNode));
+    grown->node.type = STRINGMAP_NODE256;
+    *ref = grown;
+    EZ_FREE(node);
+    return StringMapAddChild256(grown, c, child);
+}
+
+static int StringMapAddChild16(StringNode16 *node, void **ref, uint8_t c, void *child) {
+    if (node->node.count < 16) {
+        int count = node->node.count, pos = 0;
+#if defined(EZMAP_SSE2)
+        // Unsigned compare by flipping the sign bits
+        const __m128i flip = _mm_set1_epi8((char)0x80);
+        __m128i keys = _mm_xor_si128(_mm_loadu_si128((const __m128i*)node->keys), flip);
+        uint32_t bits = (uint32_t)_mm_movemask_epi8(_mm_cmplt_epi8(_mm_set1_epi8((char)(c ^ 0x80)), keys)) & ((1u << count) - 1);
+        pos = bits ? (int)FlatMapCtz(bits) : count;
+#else
+        while (pos < count && node->keys[pos] < c)
+            pos++;
+#endif
+        memmove(node->keys + pos + 1, node->keys + pos, count - pos);
+        memmove(node->children + pos + 1, node->children + pos, (count - pos) * sizeof(void*));
+        node->keys[pos] = c;
+        node->children[pos] = child;
+        node->node.count++;
+        return 1;
+    }
+    StringNode48 *grown = (StringNode48*)StringMapNodeNew(STRINGMAP_NODE48);
+    if (!grown)
+        return 0;
+    memcpy(grown->children, node->children, sizeof(void*) * 16);
+    for (int i = 0; i < 16; i++)
+        grown->index[node->keys[i]] = i + 1;
+    memcpy(&grown->node, &node->node, sizeof(StringNode));
+    grown->node.type = STRINGMAP_NODE48;
+    *ref = grown;
+    EZ_FREE(node);
+    return StringMapAddChild48(grown, ref, c, child);
+}
+
+static int StringMapAddChild4(StringNode4 *node, void **ref, uint8_t c, void *child) {
+    if (node->node.count < 4) {
+        int count = node->node.count, pos = 0;
+        while (pos < count && node->keys[pos] < c)
+            pos++;
+        memmove(node->keys + pos + 1, node->keys + pos, count - pos);
+        memmove(node->children + pos + 1, node->children + pos, (count - pos) * sizeof(void*));
+        node->keys[pos] = c;
+        node->children[pos] = child;
+        node->node.count++;
+        return 1;
+    }
+    StringNode16 *grown = (StringNode16*)StringMapNodeNew(STRINGMAP_NODE16);
+    if (!grown)
+        return 0;
+    memcpy(grown->children, node->children, sizeof(void*) * 4);
+    memcpy(grown->keys, node->keys, 4);
+    memcpy(&grown->node, &node->node, sizeof(StringNode));
+    grown->node.type = STRINGMAP_NODE16;
+    *ref = grown;
+    EZ_FREE(node);
+    return StringMapAddChild16(grown, ref, c, child);
+}
+
+static int StringMapAddChild(StringNode *node, void **ref, uint8_t c, void *child) {
+    switch (node->type) {
+        case STRINGMAP_NODE4:
+            return StringMapAddChild4((StringNode4*)node, ref, c, child);
+        case STRINGMAP_NODE16:
+            return StringMapAddChild16((StringNode16*)node, ref, c, child);
+        case STRINGMAP_NODE48:
+            return StringMapAddChild48((StringNode48*)node, ref, c, child);
+        default:
+            return StringMapAddChild256((StringNode256*)node, c, child);
+    }
+}
+
+// Returns 1 if the key was added, 2 if it was already there, 0 if out of memory
+static int StringMapInsert(void *node, void **ref, const char *key, size_t length, void *value, size_t depth) {
+    for (;;) {
+        if (!node)
+            return (*ref = StringMapLeafNew(key, length, value)) != NULL;
+        if (STRINGMAP_IS_LEAF(node)) {
+            StringLeaf *leaf = STRINGMAP_LEAF(node);
+            if (StringMapLeafMatches(leaf, key, length)) {
+                leaf->value = value;
+                return 2;
+            }
+            // Split the leaf, the new node's prefix is what both keys share
+            StringNode4 *split = (StringNode4*)StringMapNodeNew(STRINGMAP_NODE4);
+            void *added = StringMapLeafNew(key, length, value);
+            if (!split || !added) {
+                EZ_FREE(split);
+                EZ_FREE(added ? STRINGMAP_LEAF(added) : NULL);
+                return 0;
+            }
+            size_t max = STRINGMAP_MIN(leaf->length, length), common = depth;
+            while (common < max && leaf->key[common] == key[common])
+                common++;
+            common -= depth;
+            split->node.prefixLength = (uint32_t)common;
+            memcpy(split->node.prefix, key + depth, STRINGMAP_MIN(STRINGMAP_MAX_PREFIX, common));
+            StringMapAddChild4(split, ref, (uint8_t)leaf->key[depth + common], node);
+            StringMapAddChild4(split, ref, (uint8_t)key[depth + common], added);
+            *ref = split;
+            return 1;
+        }
+        StringNode *n = (StringNode*)node;
+        if (n->prefixLength) {
+            size_t diff = StringMapPrefixMismatch(n, key, length, depth);
+            if (diff < n->prefixLength) {
+                // The key leaves the prefix part way, split it at that byte
+                StringNode4 *split = (StringNode4*)StringMapNodeNew(STRINGMAP_NODE4);
+                void *added = StringMapLeafNew(key, length, value);
+                if (!split || !added) {
+                    EZ_FREE(split);
+                    EZ_FREE(added ? STRINGMAP_LEAF(added) : NULL);
+                    return 0;
+                }
+                *ref = split;
+                split->node.prefixLength = (uint32_t)diff;
+                memcpy(split->node.prefix, n->prefix, STRINGMAP_MIN(STRINGMAP_MAX_PREFIX, diff));
+                if (n->prefixLength <= STRINGMAP_MAX_PREFIX) {
+                    StringMapAddChild4(split, ref, n->prefix[diff], n);
+                    n->prefixLength -= (uint32_t)diff + 1;
+                    memmove(n->prefix, n->prefix + diff + 1, STRINGMAP_MIN(STRINGMAP_MAX_PREFIX, n->prefixLength));
+                } else {
+                    n->prefixLength -= (uint32_t)diff + 1;
+                    StringLeaf *min = StringMapMinimum(n);
+                    StringMapAddChild4(split, ref, (uint8_t)min->key[depth + diff], n);
+                    memcpy(n->prefix, min->key + depth + diff + 1, STRINGMAP_MIN(STRINGMAP_MAX_PREFIX, n->prefixLength));
+                }
+                StringMapAddChild4(split, ref, (uint8_t)key[depth + diff], added);
+                return 1;
+            }
+            depth += n->prefixLength;
+        }
+        void **child = StringMapFindChild(n, (uint8_t)key[depth]);
+        if (!child) {
+            void *added = StringMapLeafNew(key, length, value);
+            if (!added)
+                return 0;
+            if (!StringMapAddChild(n, ref, (uint8_t)key[depth], added)) {
+                EZ_FREE(STRINGMAP_LEAF(added));
+                return 0;
+            }
+            return 1;
+        }
+        node = *child;
+        ref = child;
+        depth++;
+    }
+}
+
+static void StringMapRemoveChild(StringNode *node, void **ref, uint8_t c, void **slot) {
+    switch (node->type) {
+        case STRINGMAP_NODE4: {
+            StringNode4 *n = (StringNode4*)node;
+            int pos = (int)(slot - n->children);
+            memmove(n->keys + pos, n->keys + pos + 1, node->count - 1 - pos);
+            memmove(n->children + pos, n->children + pos + 1, (node->count - 1 - pos) * sizeof(void*));
+            if (--node->count == 1) {
+                // Merge into the only child, its prefix becomes ours + the key byte + its own
+                void *child = n->children[0];
+                if (!STRINGMAP_IS_LEAF(child)) {
+                    StringNode *c = (StringNode*)child;
+                    uint32_t prefix = node->prefixLength;
+                    if (prefix < STRINGMAP_MAX_PREFIX) {
+                        node->prefix[prefix++] = n->keys[0];
+                        if (prefix < STRINGMAP_MAX_PREFIX) {
+                            uint32_t sub = STRINGMAP_MIN(c->prefixLength, STRINGMAP_MAX_PREFIX - prefix);
+                            memcpy(node->prefix + prefix, c->prefix, sub);
+                            prefix += sub;
+                        }
+                    }
+                    memcpy(c->prefix, node->prefix, STRINGMAP_MIN(prefix, STRINGMAP_MAX_PREFIX));
+                    c->prefixLength += node->prefixLength + 1;
+                }
+                *ref = child;
+                EZ_FREE(node);
+            }
+            break;
+        }
+        case STRINGMAP_NODE16: {
+            StringNode16 *n = (StringNode16*)node;
+            int pos = (int)(slot - n->children);
+            memmove(n->keys + pos, n->keys + pos + 1, node->count - 1 - pos);
+            memmove(n->children + pos, n->children + pos + 1, (node->count - 1 - pos) * sizeof(void*));
+            if (--node->count == 3) {
+                // Keep the bigger node if the smaller can't be allocated
+                StringNode4 *shrunk = (StringNode4*)StringMapNodeNew(STRINGMAP_NODE4);
+                if (!shrunk)
+                    break;
+                memcpy(&shrunk->node, node, sizeof(StringNode));
+                shrunk->node.type = STRINGMAP_NODE4;
+                memcpy(shrunk->keys, n->keys, 3);
+                memcpy(shrunk->children, n->children, 3 * sizeof(void*));
+                *ref = shrunk;
+                EZ_FREE(node);
+            }
+            break;
+        }
+        case STRINGMAP_NODE48: {
+            StringNode48 *n = (StringNode48*)node;
+            n->children[n->index[c] - 1] = NULL;
+            n->index[c] = 0;
+            if (--node->count == 12) {
+                StringNode16 *shrunk = (StringNode16*)StringMapNodeNew(STRINGMAP_NODE16);
+                if (!shrunk)
+                    break;
+                memcpy(&shrunk->node, node, sizeof(StringNode));
+                shrunk->node.type = STRINGMAP_NODE16;
+                for (int i = 0, j = 0; i < 256; i++)
+                    if (n->index[i]) {
+                        shrunk->keys[j] = (uint8_t)i;
+                        shrunk->children[j++] = n->children[n->index[i] - 1];
+                    }
+                *ref = shrunk;
+                EZ_FREE(node);
+            }
+            break;
+        }
+        default: {
+            StringNode256 *n = (StringNode256*)node;
+            n->children[c] = NULL;
+            if (--node->count == 37) {
+                StringNode48 *shrunk = (StringNode48*)StringMapNodeNew(STRINGMAP_NODE48);
+                if (!shrunk)
+                    break;
+                memcpy(&shrunk->node, node, sizeof(StringNode));
+                shrunk->node.type = STRINGMAP_NODE48;
+                for (int i = 0, j = 0; i < 256; i++)
+                    if (n->children[i]) {
+                        shrunk->children[j] = n->children[i];
+                        shrunk->index[i] = (uint8_t)++j;
+                    }
+                *ref = shrunk;
+                EZ_FREE(node);
+            }
+            break;
+        }
+    }
+}
+
+static StringLeaf* StringMapRemove(void **ref, const char *key, size_t length) {
+    void *node = *ref;
+    if (!node)
+        return NULL;
+    if (STRINGMAP_IS_LEAF(node)) {
+        if (!StringMapLeafMatches(STRINGMAP_LEAF(node), key, length))
+            return NULL;
+        *ref = NULL;
+        return STRINGMAP_LEAF(node);
+    }
+    for (size_t depth = 0;;) {
+        StringNode *n = (StringNode*)node;
+        if (n->prefixLength) {
+            if (!StringMapCheckPrefix(n, key, length, depth))
+                return NULL;
+            depth += n->prefixLength;
+            if (depth >= length)
+                return NULL;
+        }
+        void **child = StringMapFindChild(n, (uint8_t)key[depth]);
+        if (!child)
+            return NULL;
+        if (STRINGMAP_IS_LEAF(*child)) {
+            StringLeaf *leaf = STRINGMAP_LEAF(*child);
+            if (!StringMapLeafMatches(leaf, key, length))
+                return NULL;
+            StringMapRemoveChild(n, ref, (uint8_t)key[depth], child);
+            return leaf;
+        }
+        ref = child;
+        node = *child;
+        depth++;
+    }
+}
+
+// Visits every leaf under `node` in key order, returns 0 if `callback` stopped
+static int StringMapVisit(void *node, int(*callback)(const char*, size_t, void*, void*), void *userdata, size_t *visited) {
+    if (!node)
+        return 1;
+    if (STRINGMAP_IS_LEAF(node)) {
+        StringLeaf *leaf = STRINGMAP_LEAF(node);
+        ++*visited;
+        return callback(leaf->key, leaf->length - 1, leaf->value, userdata) != 0;
+    }
+    StringNode *n = (StringNode*)node;
+    switch (n->type) {
+        case STRINGMAP_NODE4:
+            for (int i = 0; i < n->count; i++)
+                if (!StringMapVisit(((StringNode4*)n)->children[i], callback, userdata, visited))
+                    return 0;
+            break;
+        case STRINGMAP_NODE16:
+            for (int i = 0; i < n->count; i++)
+                if (!StringMapVisit(((StringNode16*)n)->children[i], callback, userdata, visited))
+                    return 0;
+            break;
+        case STRINGMAP_NODE48: {
+            StringNode48 *n48 = (StringNode48*)n;
+            for (int i = 0; i < 256; i++)
+                if (n48->index[i] && !StringMapVisit(n48->children[n48->index[i] - 1], callback, userdata, visited))
+                    return 0;
+            break;
+        }
+        default:
+            for (int i = 0; i < 256; i++)
+                if (!StringMapVisit(((StringNode256*)n)->children[i], callback, userdata, visited))
+                    return 0;
+            break;
+    }
+    return 1;
+}
+
+static void StringMapFree(void *node) {
+    if (!node)
+        return;
+    if (STRINGMAP_IS_LEAF(node)) {
+        EZ_FREE(STRINGMAP_LEAF(node));
+        return;
+    }
+    StringNode *n = (StringNode*)node;
+    switch (n->type) {
+        case STRINGMAP_NODE4:
+            for (int i = 0; i < n->count; i++)
+                StringMapFree(((StringNode4*)n)->children[i]);
+            break;
+        case STRINGMAP_NODE16:
+            for (int i = 0; i < n->count; i++)
+                StringMapFree(((StringNode16*)n)->children[i]);
+            break;
+        case STRINGMAP_NODE48:
+            for (int i = 0; i < 48; i++)
+                StringMapFree(((StringNode48*)n)->children[i]);
+            break;
+        default:
+            for (int i = 0; i < 256; i++)
+                StringMapFree(((StringNode256*)n)->children[i]);
+            break;
+    }
+    EZ_FREE(n);
+}
+
+ezStringMap* ezStringMapNew(void) {
+    ezStringMap *map = EZ_MALLOC(sizeof(ezStringMap));
+    if (map) {
+        map->root = NULL;
+        map->count = 0;
+    }
+    return map;
+}
+
+int ezStringMapSet(ezStringMap *map, const char *key, void *value) {
+    int result = StringMapInsert(map->root, &map->root, key, strlen(key) + 1, value, 0);
+    if (result == 1)
+        map->count++;
+    return result != 0;
+}
+
+void* ezStringMapGet(ezStringMap *map, const char *key) {
+    size_t length = strlen(key) + 1, depth = 0;
+    void *node = map->root;
+    while (node) {
+        if (STRINGMAP_IS_LEAF(node)) {
+            StringLeaf *leaf = STRINGMAP_LEAF(node);
+            return StringMapLeafMatches(leaf, key, length) ? leaf->value : NULL;
+        }
+        StringNode *n = (StringNode*)node;
+        if (n->prefixLength) {
+            if (!StringMapCheckPrefix(n, key, length, depth))
+                return NULL;
+            depth += n->prefixLength;
+            if (depth >= length)
+                return NULL;
+        }
+        void **child = StringMapFindChild(n, (uint8_t)key[depth++]);
+        node = child ? *child : NULL;
+    }
+    return NULL;
+}
+
+void* ezStringMapDel(ezStringMap *map, const char *key) {
+    StringLeaf *leaf = StringMapRemove(&map->root, key, strlen(key) + 1);
+    if (!leaf)
+        return NULL;
+    void *value = leaf->value;
+    EZ_FREE(leaf);
+    map->count--;
+    return value;
+}
+
+size_t ezStringMapEach(ezStringMap *map, int(*callback)(const char *key, size_t length, void *value, void *userdata), void *userdata) {
+    size_t visited = 0;
+    StringMapVisit(map->root, callback, userdata, &visited);
+    return visited;
+}
+
+size_t ezStringMapPrefix(ezStringMap *map, const char *prefix, int(*callback)(const char *key, size_t length, void *value, void *userdata), void *userdata) {
+    size_t length = strlen(prefix), depth = 0, visited = 0;
+    void *node = map->root;
+    while (node) {
+        if (STRINGMAP_IS_LEAF(node)) {
+            StringLeaf *leaf = STRINGMAP_LEAF(node);
+            if (leaf->length > length && !memcmp(leaf->key, prefix, length))
+                StringMapVisit(node, callback, userdata, &visited);
+            break;
+        }
+        if (depth == length) {
+            StringMapVisit(node, callback, userdata, &visited);
+            break;
+        }
+        StringNode *n = (StringNode*)node;
+        if (n->prefixLength) {
+            size_t matched = StringMapPrefixMismatch(n, prefix, length, depth);
+            if (depth + matched == length) {
+                // The prefix ends inside this node's prefix, everything below matches
+                StringMapVisit(node, callback, userdata, &visited);
+                break;
+            }
+            if (matched < n->prefixLength)
+                break;
+            depth += n->prefixLength;
+        }
+        void **child = StringMapFindChild(n, (uint8_t)prefix[depth++]);
+        node = child ? *child : NULL;
+    }
+    return visited;
+}
+
+void* ezStringMapLongestPrefix(ezStringMap *map, const char *key, size_t *matched) {
+    size_t length = strlen(key), depth = 0;
+    StringLeaf *best = NULL;
+    void *node = map->root;
+    while (node) {
+        if (STRINGMAP_IS_LEAF(node)) {
+            StringLeaf *leaf = STRINGMAP_LEAF(node);
+            if (leaf->length - 1 <= length && !memcmp(leaf->key, key, leaf->length - 1))
+                best = leaf;
+            break;
+        }
+        StringNode *n = (StringNode*)node;
+        if (n->prefixLength) {
+            if (StringMapPrefixMismatch(n, key, length, depth) < n->prefixLength)
+                break;
+            depth += n->prefixLength;
+        }
+        // A key ending here is a child on the NUL byte
+        void **child = StringMapFindChild(n, 0);
+        if (child && STRINGMAP_IS_LEAF(*child))
+            best = STRINGMAP_LEAF(*child);
+        if (depth >= length)
+            break;
+        child = StringMapFindChild(n, (uint8_t)key[depth++]);
+        node = child ? *child : NULL;
+    }
+    if (matched)
+        *matched = best ? best->length - 1 : 0;
+    return best ? best->value : NULL;
+}
+
+void ezStringMapDestroy(ezStringMap *map) {
+    StringMapFree(map->root);
+    EZ_FREE(map);
+}
+
+
+// Keys are interned in entries carved from 64KB chunks, entries are rounded up
+// to 16 bytes and freed entries are kept on a list per size to be reused.
+// Entries too big for the lists are allocated on their own
+#define DICT_CHUNK_SIZE 65536
+#define DICT_ENTRY_ALIGN 16
+#define DICT_SIZE_CLASSES 16
+
+typedef struct DictEntry {
+    struct DictEntry *next; // other keys with the same hash, or the next free entry
+    void *value;
+    size_t length;
+    char key[];
+} DictEntry;
+
+typedef struct DictChunk {
+    struct DictChunk *next;
+    size_t used;
+    char data[];
+} DictChunk;
+
+struct ezDictArena {
+    DictChunk *chunks;
+    DictEntry *free[DICT_SIZE_CLASSES];
+    size_t count, large;
+    uint64_t seed;
+};
+
+uint64_t ezDictHash(ezDict *dict, const void *key, size_t length) {
+    return ezHash(key, length, dict->strings ? dict->strings->seed : EZMAP_HASH_SEED);
+}
+
+static inline size_t DictEntrySize(size_t length) {
+    return (sizeof(DictEntry) + length + 1 + DICT_ENTRY_ALIGN - 1) & ~(size_t)(DICT_ENTRY_ALIGN - 1);
+}
+
+static DictEntry* DictEntryNew(ezDictArena *arena, const void *key, size_t length) {
+    size_t size = DictEntrySize(length);
+    size_t index = size / DICT_ENTRY_ALIGN - 1;
+    DictEntry *entry = NULL;
+    if (index >= DICT_SIZE_CLASSES) {
+        if (!(entry = EZ_MALLOC(size)))
+            return NULL;
+        arena->large++;
+    } else if (arena->free[index]) {
+        entry = arena->free[index];
+        arena->free[index] = entry->next;
+    } else {
+        DictChunk *chunk = arena->chunks;
+        if (!chunk || chunk->used + size > DICT_CHUNK_SIZE - sizeof(DictChunk)) {
+            if (!(chunk = EZ_MALLOC(DICT_CHUNK_SIZE)))
+                return NULL;
+            chunk->next = arena->chunks;
+            chunk->used = 0;
+            arena->chunks = chunk;
+        }
+        entry = (DictEntry*)(chunk->data + chunk->used);
+        chunk->used += size;
+    }
+    entry->next = NULL;
+    entry->value = NULL;
+    entry->length = length;
+    memcpy(entry->key, key, length);
+    entry->key[length] = '\0';
+    arena->count++;
+    return entry;
+}
+
+static void DictEntryFree(ezDictArena *arena, DictEntry *entry) {
+    size_t index = DictEntrySize(entry->length) / DICT_ENTRY_ALIGN - 1;
+    if (index >= DICT_SIZE_CLASSES) {
+        EZ_FREE(entry);
+        arena->large--;
+    } else {
+        entry->next = arena->free[index];
+        arena->free[index] = entry;
+    }
+    arena->count--;
+}
+
+static void DictArenaDestroy(ezDict *dict) {
+    ezDictArena *arena = dict->strings;
+    // Only large entries live outside the chunks, walk the map for them
+    if (arena->large && !dict->mapped) {
+        imap_iter_t iter;
+        for (imap_pair_t pair = imap_iterate(dict->tree, &iter, 1); pair.slot; pair = imap_iterate(dict->tree, &iter, 0))
+            for (DictEntry *entry = (DictEntry*)imap_getval(dict->tree, pair.slot), *next; entry; entry = next) {
+                next = entry->next;
+                if (DictEntrySize(entry->length) / DICT_ENTRY_ALIGN - 1 >= DICT_SIZE_CLASSES)
+                    EZ_FREE(entry);
+            }
+    }
+    for (DictChunk *chunk = arena->chunks, *next; chunk; chunk = next) {
+        next = chunk->next;
+        EZ_FREE(chunk);
+    }
+    EZ_FREE(arena);
+    dict->strings = NULL;
+}
+
+static inline DictEntry* DictFind(DictEntry *entry, const void *key, size_t length) {
+    for (; entry; entry = entry->next)
+        if (entry->length == length && !memcmp(entry->key, key, length))
+            return entry;
+    return NULL;
+}
+
+size_t ezDictCount(ezDict *dict) {
+    return dict->strings ? dict->strings->count : 0;
+}
+
+static int DictArenaNew(ezDict *dict) {
+    if (dict->strings)
+        return 1;
+    if (!(dict->strings = EZ_MALLOC(sizeof(ezDictArena))))
+        return 0;
+    memset(dict->strings, 0, sizeof(ezDictArena));
+    dict->strings->seed = EZMAP_HASH_SEED;
+    return 1;
+}
+
+int ezDictSeed(ezDict *dict, uint64_t seed) {
+    if (ezDictCount(dict) || !DictArenaNew(dict))
+        return 0;
+    dict->strings->seed = seed;
+    return 1;
+}
+
+int ezDictSetHashed(ezDict *dict, const void *key, size_t length, uint64_t hash, void *value) {
+    if (dict->mapped || dict->valueSize || !DictArenaNew(dict))
+        return 0;
+    imap_slot_t *slot = imap_lookup(dict->tree, hash);
+    DictEntry *head = slot ? (DictEntry*)imap_getval(dict->tree, slot) : NULL;
+    DictEntry *entry = DictFind(head, key, length);
+    if (entry) {
+        entry->value = value;
+        return 1;
+    }
+    if (!(entry = DictEntryNew(dict->strings, key, length)))
+        return 0;
+    entry->value = value;
+    if (slot) {
+        // Colliding keys share the hash's slot, nothing is added to the trie. A
+        // small pointer may be stored inline, so the new one could need a value
+        // cell: make room first (which can move the tree) and find the slot again
+        if (!KeyMapReserve(dict, 1, NULL)) {
+            DictEntryFree(dict->strings, entry);
+            return 0;
+        }
+        entry->next = head;
+        imap_setval(dict->tree, imap_lookup(dict->tree, hash), (uint64_t)entry);
+    } else if (!ezKeyMapSet(dict, hash, entry)) {
+        DictEntryFree(dict->strings, entry);
+        return 0;
+    }
+    return 1;
+}
+
+void* ezDictGetHashed(ezDict *dict, const void *key, size_t length, uint64_t hash) {
+    if (!dict->strings || KEYMAP_FILTERED(dict, hash))
+        return NULL;
+    imap_slot_t *slot = imap_lookup(dict->tree, hash);
+    DictEntry *entry = slot ? DictFind((DictEntry*)imap_getval(dict->tree, slot), key, length) : NULL;
+    return entry ? entry->value : NULL;
+}
+
+void* ezDictDelHashed(ezDict *dict, const void *key, size_t length, uint64_t hash) {
+    if (!dict->strings || dict->mapped)
+        return NULL;
+    imap_slot_t *slot = imap_lookup(dict->tree, hash);
+    if (!slot)
+        return NULL;
+    DictEntry *head = (DictEntry*)imap_getval(dict->tree, slot);
+    DictEntry *prev = NULL, *entry = head;
+    for (; entry; prev = entry, entry = entry->next)
+        if (entry->length == length && !memcmp(entry->key, key, length))
+            break;
+    if (!entry)
+        return NULL;
+    if (prev)
+        prev->next = entry->next;
+    else if (entry->next) {
+        // As in ezDictSetHashed the next entry may need a value cell
+        if (!KeyMapReserve(dict, 1, NULL))
+            return NULL;
+        imap_setval(dict->tree, imap_lookup(dict->tree, hash), (uint64_t)entry->next);
+    } else
+        ezKeyMapDel(dict, hash);
+    void *value = entry->value;
+    DictEntryFree(dict->strings, entry);
+    return value;
+}
+
+int ezDictSet(ezDict *dict, const char *key, void *value) {
+    size_t length = strlen(key);
+    return ezDictSetHashed(dict, key, length, ezDictHash(dict, key, length), value);
+}
+
+void* ezDictGet(ezDict *dict, const char *key) {
+    size_t length = strlen(key);
+    return ezDictGetHashed(dict, key, length, ezDictHash(dict, key, length));
+}
+
+void* ezDictDel(ezDict *dict, const char *key) {
+    size_t length = strlen(key);
+    return ezDictDelHashed(dict, key, length, ezDictHash(dict, key, length));
+}
+
+size_t ezDictEach(ezDict *dict, int(*callback)(const char *key, size_t length, void *value, void *userdata), void *userdata) {
+    if (!dict->strings)
+        return 0;
+    imap_iter_t iter;
+    size_t visited = 0;
+    for (imap_pair_t pair = imap_iterate(dict->tree, &iter, 1); pair.slot; pair = imap_iterate(dict->tree, &iter, 0))
+        for (DictEntry *entry = (DictEntry*)imap_getval(dict->tree, pair.slot); entry; entry = entry->next) {
+            visited++;
+            if (!callback(entry->key, entry->length, entry->value, userdata))
+                return visited;
+        }
+    return visited;
 }
 #endif
@@ -0,0 +1,441 @@
+/* eznoise.h -- https://github.com/takeiteasy/ez
+
+ eznoise -- Procedural value, Perlin + simplex noise
+
+ Copyright (C) 2024  George Watson
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+ Acknowledgements:
+
+  - Improved Perlin noise is based on Ken Perlin's reference implementation
+  - Simplex noise is based on Stefan Gustavson's "Simplex noise demystified" */
+
+#ifndef EZNOISE_HEADER
+#define EZNOISE_HEADER
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#include "ezrng.h"
+
+#if !defined(EZ_MALLOC)
+#define EZ_MALLOC malloc
+#endif
+#if !defined(EZ_FREE)
+#define EZ_FREE free
+#endif
+
+typedef enum {
+    EZ_NOISE_VALUE = 0,
+    EZ_NOISE_PERLIN,
+    EZ_NOISE_SIMPLEX
+} ezNoiseType;
+
+typedef struct ezNoise {
+    int perm[512];
+} ezNoise;
+
+typedef struct ezNoiseParams {
+    ezNoiseType type;
+    // Scale from pixel to noise coordinates, and the noise coordinate of pixel 0,0
+    float frequency, offsetX, offsetY;
+    // fBm octaves (1 for plain noise), each one multiplies the frequency by
+    // `lacunarity` and the amplitude by `gain`
+    int octaves;
+    float lacunarity, gain;
+} ezNoiseParams;
+
+// The permutation table is shuffled with `rng`
+ezNoise* ezNoiseNew(ezRng *rng);
+void ezNoiseSeed(ezNoise *noise, ezRng *rng);
+#define ezNoiseFree(N) EZ_FREE((N))
+
+// Single samples, results are roughly in [-1, 1]
+float ezNoise2D(ezNoise *noise, ezNoiseType type, float x, float y);
+float ezNoiseFBm2D(ezNoise *noise, const ezNoiseParams *params, float x, float y);
+
+// Fill a `w` * `h` buffer, rows are generated 8 pixels at a time with AVX2
+void ezNoiseFill(ezNoise *noise, const ezNoiseParams *params, float *dst, int w, int h);
+// Only rows [y0, y1) of `dst`, for splitting work up between threads
+void ezNoiseFillRows(ezNoise *noise, const ezNoiseParams *params, float *dst, int w, int y0, int y1);
+
+// Include ezimage.h before this header to render noise to greyscale images
+#if defined(EZIMAGE_HEADER)
+void ezNoiseImage(ezNoise *noise, const ezNoiseParams *params, ezImage *img);
+#endif
+
+// Include ezthreads.h before this header to spread rows across a thread pool
+#if defined(EZTHREADS_HEADER)
+void ezNoiseFillParallel(ezThreadPool *pool, ezNoise *noise, const ezNoiseParams *params, float *dst, int w, int h);
+#if defined(EZIMAGE_HEADER)
+void ezNoiseImageParallel(ezThreadPool *pool, ezNoise *noise, const ezNoiseParams *params, ezImage *img);
+#endif
+#endif
+
+#if defined(__cplusplus)
+}
+#endif
+#endif // EZNOISE_HEADER
+
+#if defined(EZNOISE_IMPLEMENTATION) || defined(EZ_IMPLEMENTATION)
+#include <math.h>
+#include <string.h>
+#if defined(__AVX2__) && !defined(EZNOISE_DISABLE_SIMD)
+#define EZNOISE_AVX2
+#include <immintrin.h>
+#endif
+
+#define NOISE_F2 0.36602540378f // (sqrt(3) - 1) / 2
+#define NOISE_G2 0.2113248654f  // (3 - sqrt(3)) / 6
+#define NOISE_SIMPLEX_SCALE 70.f
+
+static const float NoiseGradX[8] = {1.f, -1.f, 1.f, -1.f, 1.f, -1.f, 0.f, 0.f};
+static const float NoiseGradY[8] = {1.f, 1.f, -1.f, -1.f, 0.f, 0.f, 1.f, -1.f};
+
+void ezNoiseSeed(ezNoise *noise, ezRng *rng) {
+    for (int i = 0; i < 256; i++)
+        noise->perm[i] = i;
+    ezRngShuffle(rng, noise->perm, 256, sizeof(int));
+    memcpy(noise->perm + 256, noise->perm, 256 * sizeof(int));
+}
+
+ezNoise* ezNoiseNew(ezRng *rng) {
+    ezNoise *noise = EZ_MALLOC(sizeof(ezNoise));
+    ezNoiseSeed(noise, rng);
+    return noise;
+}
+
+static inline int NoiseHash(const int *perm, int i, int j) {
+    return perm[perm[i & 255] + (j & 255)];
+}
+
+static inline float NoiseFade(float t) {
+    return t * t * t * (t * (t * 6.f - 15.f) + 10.f);
+}
+
+static inline float NoiseLerp(float a, float b, float t) {
+    return a + t * (b - a);
+}
+
+static inline float NoiseGrad(int hash, float x, float y) {
+    return NoiseGradX[hash & 7] * x + NoiseGradY[hash & 7] * y;
+}
+
+static float NoiseValue(const int *perm, float x, float y) {
+    float fx = floorf(x), fy = floorf(y);
+    int xi = (int)fx, yi = (int)fy;
+    float u = NoiseFade(x - fx), v = NoiseFade(y - fy);
+    float a = NoiseHash(perm, xi, yi) * (1.f / 127.5f) - 1.f;
+    float b = NoiseHash(perm, xi + 1, yi) * (1.f / 127.5f) - 1.f;
+    float c = NoiseHash(perm, xi, yi + 1) * (1.f / 127.5f) - 1.f;
+    float d = NoiseHash(perm, xi + 1, yi + 1) * (1.f / 127.5f) - 1.f;
+    return NoiseLerp(NoiseLerp(a, b, u), NoiseLerp(c, d, u), v);
+}
+
+static float NoisePerlin(const int *perm, float x, float y) {
+    float fx = floorf(x), fy = floorf(y);
+    int xi = (int)fx, yi = (int)fy;
+    x -= fx;
+    y -= fy;
+    float u = NoiseFade(x), v = NoiseFade(y);
+    float a = NoiseGrad(NoiseHash(perm, xi, yi), x, y);
+    float b = NoiseGrad(NoiseHash(perm, xi + 1, yi), x - 1.f, y);
+    float c = NoiseGrad(NoiseHash(perm, xi, yi + 1), x, y - 1.f);
+    float d = NoiseGrad(NoiseHash(perm, xi + 1, yi + 1), x - 1.f, y - 1.f);
+    return NoiseLerp(NoiseLerp(a, b, u), NoiseLerp(c, d, u), v);
+}
+
+static inline float NoiseCorner(int hash, float x, float y) {
+    float t = .5f - (x * x + y * y);
+    if (t < 0.f)
+        return 0.f;
+    t *= t;
+    return t * t * NoiseGrad(hash, x, y);
+}
+
+static float NoiseSimplex(const int *perm, float x, float y) {
+    float s = (x + y) * NOISE_F2;
+    float fi = floorf(x + s), fj = floorf(y + s);
+    int i = (int)fi, j = (int)fj;
+    float t = (fi + fj) * NOISE_G2;
+    float x0 = x - (fi - t), y0 = y - (fj - t);
+    int i1 = x0 > y0, j1 = !i1;
+    float x1 = x0 - i1 + NOISE_G2, y1 = y0 - j1 + NOISE_G2;
+    float x2 = x0 - 1.f + 2.f * NOISE_G2, y2 = y0 - 1.f + 2.f * NOISE_G2;
+    float n = NoiseCorner(NoiseHash(perm, i, j), x0, y0) +
+              NoiseCorner(NoiseHash(perm, i + i1, j + j1), x1, y1) +
+              NoiseCorner(NoiseHash(perm, i + 1, j + 1), x2, y2);
+    return NOISE_SIMPLEX_SCALE * n;
+}
+
+float ezNoise2D(ezNoise *noise, ezNoiseType type, float x, float y) {
+    switch (type) {
+        case EZ_NOISE_VALUE:
+            return NoiseValue(noise->perm, x, y);
+        case EZ_NOISE_PERLIN:
+            return NoisePerlin(noise->perm, x, y);
+        case EZ_NOISE_SIMPLEX:
+        default:
+            return NoiseSimplex(noise->perm, x, y);
+    }
+}
+
+static float NoiseAmplitudeSum(const ezNoiseParams *params) {
+    float sum = 0.f, amp = 1.f;
+    int octaves = params->octaves > 0 ? params->octaves : 1;
+    for (int o = 0; o < octaves; o++, amp *= params->gain)
+        sum += amp;
+    return sum;
+}
+
+// Same operations in the same order as the row fill, so both give the same bits
+// unless the compiler fuses multiply-adds (e.g. -march=native or -mfma without
+// -ffp-contract=off), the AVX2 intrinsics are never fused
+float ezNoiseFBm2D(ezNoise *noise, const ezNoiseParams *params, float x, float y) {
+    float result = 0.f, amp = 1.f / NoiseAmplitudeSum(params), freq = 1.f;
+    int octaves = params->octaves > 0 ? params->octaves : 1;
+    for (int o = 0; o < octaves; o++) {
+        result += amp * ezNoise2D(noise, params->type, x * freq, y * freq);
+        amp *= params->gain;
+        freq *= params->lacunarity;
+    }
+    return result;
+}
+
+#if defined(EZNOISE_AVX2)
+static inline __m256i NoiseHash8(const int *perm, __m256i i, __m256i j) {
+    const __m256i mask = _mm256_set1_epi32(255);
+    __m256i p = _mm256_i32gather_epi32(perm, _mm256_and_si256(i, mask), 4);
+    return _mm256_i32gather_epi32(perm, _mm256_add_epi32(p, _mm256_and_si256(j, mask)), 4);
+}
+
+static inline __m256 NoiseFade8(__m256 t) {
+    __m256 r = _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.f)), _mm256_set1_ps(15.f));
+    r = _mm256_add_ps(_mm256_mul_ps(t, r), _mm256_set1_ps(10.f));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), r);
+}
+
+static inline __m256 NoiseLerp8(__m256 a, __m256 b, __m256 t) {
+    return _mm256_add_ps(a, _mm256_mul_ps(t, _mm256_sub_ps(b, a)));
+}
+
+// The gradient tables fit in a register, permutevar only looks at hash & 7
+static inline __m256 NoiseGrad8(__m256i hash, __m256 x, __m256 y) {
+    __m256 gx = _mm256_permutevar8x32_ps(_mm256_loadu_ps(NoiseGradX), hash);
+    __m256 gy = _mm256_permutevar8x32_ps(_mm256_loadu_ps(NoiseGradY), hash);
+    return _mm256_add_ps(_mm256_mul_ps(gx, x), _mm256_mul_ps(gy, y));
+}
+
+static inline __m256 NoiseValue8(const int *perm, __m256 x, __m256 y) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 scale = _mm256_set1_ps(1.f / 127.5f), minus = _mm256_set1_ps(1.f);
+    __m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y);
+    __m256i xi = _mm256_cvtps_epi32(fx), yi = _mm256_cvtps_epi32(fy);
+    __m256i xj = _mm256_add_epi32(xi, one), yj = _mm256_add_epi32(yi, one);
+    __m256 u = NoiseFade8(_mm256_sub_ps(x, fx)), v = NoiseFade8(_mm256_sub_ps(y, fy));
+    __m256 a = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(NoiseHash8(perm, xi, yi)), scale), minus);
+    __m256 b = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(NoiseHash8(perm, xj, yi)), scale), minus);
+    __m256 c = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(NoiseHash8(perm, xi, yj)), scale), minus);
+    __m256 d = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(NoiseHash8(perm, xj, yj)), scale), minus);
+    return NoiseLerp8(NoiseLerp8(a, b, u), NoiseLerp8(c, d, u), v);
+}
+
+static inline __m256 NoisePerlin8(const int *perm, __m256 x, __m256 y) {
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256 onef = _mm256_set1_ps(1.f);
+    __m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y);
+    __m256i xi = _mm256_cvtps_epi32(fx), yi = _mm256_cvtps_epi32(fy);
+    __m256i xj = _mm256_add_epi32(xi, one), yj = _mm256_add_epi32(yi, one);
+    x = _mm256_sub_ps(x, fx);
+    y = _mm256_sub_ps(y, fy);
+    __m256 x1 = _mm256_sub_ps(x, onef), y1 = _mm256_sub_ps(y, onef);
+    __m256 u = NoiseFade8(x), v = NoiseFade8(y);
+    __m256 a = NoiseGrad8(NoiseHash8(perm, xi, yi), x, y);
+    __m256 b = NoiseGrad8(NoiseHash8(perm, xj, yi), x1, y);
+    __m256 c = NoiseGrad8(NoiseHash8(perm, xi, yj), x, y1);
+    __m256 d = NoiseGrad8(NoiseHash8(perm, xj, yj), x1, y1);
+    return NoiseLerp8(NoiseLerp8(a, b, u), NoiseLerp8(c, d, u), v);
+}
+
+static inline __m256 NoiseCorner8(__m256i hash, __m256 x, __m256 y) {
+    __m256 t = _mm256_sub_ps(_mm256_set1_ps(.5f), _mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)));
+    t = _mm256_max_ps(t, _mm256_setzero_ps());
+    t = _mm256_mul_ps(t, t);
+    return _mm256_mul_ps(_mm256_mul_ps(t, t), NoiseGrad8(hash, x, y));
+}
+
+static inline __m256 NoiseSimplex8(const int *perm, __m256 x, __m256 y) {
+    const __m256 g2 = _mm256_set1_ps(NOISE_G2), onef = _mm256_set1_ps(1.f);
+    __m256 s = _mm256_mul_ps(_mm256_add_ps(x, y), _mm256_set1_ps(NOISE_F2));
+    __m256 fi = _mm256_floor_ps(_mm256_add_ps(x, s)), fj = _mm256_floor_ps(_mm256_add_ps(y, s));
+    __m256i i = _mm256_cvtps_epi32(fi), j = _mm256_cvtps_epi32(fj);
+    __m256 t = _mm256_mul_ps(_mm256_add_ps(fi, fj), g2);
+    __m256 x0 = _mm256_sub_ps(x, _mm256_sub_ps(fi, t)), y0 = _mm256_sub_ps(y, _mm256_sub_ps(fj, t));
+    // Lower or upper triangle of the skewed cell, all bits set where x0 > y0
+    __m256 upper = _mm256_cmp_ps(x0, y0, _CMP_GT_OQ);
+    __m256 i1 = _mm256_and_ps(upper, onef), j1 = _mm256_andnot_ps(upper, onef);
+    __m256 x1 = _mm256_add_ps(_mm256_sub_ps(x0, i1), g2), y1 = _mm256_add_ps(_mm256_sub_ps(y0, j1), g2);
+    __m256 x2 = _mm256_add_ps(_mm256_sub_ps(x0, onef), _mm256_add_ps(g2, g2));
+    __m256 y2 = _mm256_add_ps(_mm256_sub_ps(y0, onef), _mm256_add_ps(g2, g2));
+    __m256i one = _mm256_set1_epi32(1);
+    __m256i ii = _mm256_add_epi32(i, _mm256_cvtps_epi32(i1)), jj = _mm256_add_epi32(j, _mm256_cvtps_epi32(j1));
+    __m256 n = _mm256_add_ps(_mm256_add_ps(NoiseCorner8(NoiseHash8(perm, i, j), x0, y0),
+                                           NoiseCorner8(NoiseHash8(perm, ii, jj), x1, y1)),
+                             NoiseCorner8(NoiseHash8(perm, _mm256_add_epi32(i, one), _mm256_add_epi32(j, one)), x2, y2));
+    return _mm256_mul_ps(n, _mm256_set1_ps(NOISE_SIMPLEX_SCALE));
+}
+#endif
+
+// out[i] += amp * noise((x0 + i * dx) * scale, y) for one row of `w` samples.
+// The scalar tail does the same operations as the AVX2 loop, so the results
+// don't depend on the width or on whether AVX2 is enabled (as long as the
+// compiler doesn't fuse multiply-adds, see -ffp-contract)
+static void NoiseRowAdd(const int *perm, ezNoiseType type, float *out, int w, float x0, float dx, float scale, float y, float amp) {
+    int i = 0;
+#if defined(EZNOISE_AVX2)
+    const __m256 steps = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+    const __m256 vdx = _mm256_set1_ps(dx), vscale = _mm256_set1_ps(scale);
+    const __m256 vy = _mm256_set1_ps(y), vamp = _mm256_set1_ps(amp);
+    for (; i + 8 <= w; i += 8) {
+        __m256 vx = _mm256_add_ps(_mm256_set1_ps(x0), _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps((float)i), steps), vdx));
+        vx = _mm256_mul_ps(vx, vscale);
+        __m256 n;
+        switch (type) {
+            case EZ_NOISE_VALUE:
+                n = NoiseValue8(perm, vx, vy);
+                break;
+            case EZ_NOISE_PERLIN:
+                n = NoisePerlin8(perm, vx, vy);
+                break;
+            case EZ_NOISE_SIMPLEX:
+            default:
+                n = NoiseSimplex8(perm, vx, vy);
+                break;
+        }
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), _mm256_mul_ps(n, vamp)));
+    }
+#endif
+    for (; i < w; i++) {
+        float x = (x0 + (float)i * dx) * scale;
+        switch (type) {
+            case EZ_NOISE_VALUE:
+                out[i] += amp * NoiseValue(perm, x, y);
+                break;
+            case EZ_NOISE_PERLIN:
+                out[i] += amp * NoisePerlin(perm, x, y);
+                break;
+            case EZ_NOISE_SIMPLEX:
+            default:
+                out[i] += amp * NoiseSimplex(perm, x, y);
+                break;
+        }
+    }
+}
+
+static void NoiseRow(ezNoise *noise, const ezNoiseParams *params, float *out, int w, int y) {
+    int octaves = params->octaves > 0 ? params->octaves : 1;
+    float amp = 1.f / NoiseAmplitudeSum(params), freq = 1.f;
+    memset(out, 0, w * sizeof(float));
+    for (int o = 0; o < octaves; o++) {
+        float ny = (params->offsetY + y * params->frequency) * freq;
+        NoiseRowAdd(noise->perm, params->type, out, w, params->offsetX, params->frequency, freq, ny, amp);
+        amp *= params->gain;
+        freq *= params->lacunarity;
+    }
+}
+
+void ezNoiseFillRows(ezNoise *noise, const ezNoiseParams *params, float *dst, int w, int y0, int y1) {
+    for (int y = y0; y < y1; y++)
+        NoiseRow(noise, params, dst + (size_t)y * w, w, y);
+}
+
+void ezNoiseFill(ezNoise *noise, const ezNoiseParams *params, float *dst, int w, int h) {
+    ezNoiseFillRows(noise, params, dst, w, 0, h);
+}
+
+#if defined(EZIMAGE_HEADER)
+// Maps [-1, 1] to opaque greyscale
+static void NoiseRowToPixels(const float *row, int *dst, int w) {
+    for (int i = 0; i < w; i++) {
+        float v = row[i] * 127.5f + 127.5f;
+        v = v < 0.f ? 0.f : v > 255.f ? 255.f : v;
+        dst[i] = (int)(0xFF000000u | ((unsigned int)v * 0x010101u));
+    }
+}
+
+static void NoiseImageRows(ezNoise *noise, const ezNoiseParams *params, ezImage *img, int y0, int y1) {
+    float *row = EZ_MALLOC(img->w * sizeof(float));
+    for (int y = y0; y < y1; y++) {
+        NoiseRow(noise, params, row, img->w, y);
+        NoiseRowToPixels(row, img->buf + (size_t)y * img->w, img->w);
+    }
+    EZ_FREE(row);
+}
+
+void ezNoiseImage(ezNoise *noise, const ezNoiseParams *params, ezImage *img) {
+    NoiseImageRows(noise, params, img, 0, img->h);
+}
+#endif
+
+#if defined(EZTHREADS_HEADER)
+typedef struct {
+    ezNoise *noise;
+    const ezNoiseParams *params;
+    float *dst;
+    void *img;
+    int w, y0, y1;
+} NoiseJob;
+
+static void NoiseFillJob(void *arg) {
+    NoiseJob *job = (NoiseJob*)arg;
+    ezNoiseFillRows(job->noise, job->params, job->dst, job->w, job->y0, job->y1);
+}
+
+// Splits `h` rows into a few bands per thread and waits for the pool to finish
+static void NoiseDispatch(ezThreadPool *pool, void(*func)(void*), NoiseJob *proto, int h) {
+    size_t bands = pool->threadCount * 4;
+    if (bands > (size_t)h)
+        bands = h;
+    if (!bands)
+        return;
+    NoiseJob *jobs = EZ_MALLOC(bands * sizeof(NoiseJob));
+    for (size_t b = 0; b < bands; b++) {
+        jobs[b] = *proto;
+        jobs[b].y0 = (int)(h * b / bands);
+        jobs[b].y1 = (int)(h * (b + 1) / bands);
+        ezThreadPoolAddWork(pool, func, &jobs[b]);
+    }
+    ezThreadPoolJoin(pool);
+    EZ_FREE(jobs);
+}
+
+void ezNoiseFillParallel(ezThreadPool *pool, ezNoise *noise, const ezNoiseParams *params, float *dst, int w, int h) {
+    NoiseJob proto = {noise, params, dst, NULL, w, 0, 0};
+    NoiseDispatch(pool, NoiseFillJob, &proto, h);
+}
+
+#if defined(EZIMAGE_HEADER)
+static void NoiseImageJob(void *arg) {
+    NoiseJob *job = (NoiseJob*)arg;
+    NoiseImageRows(job->noise, job->params, (ezImage*)job->img, job->y0, job->y1);
+}
+
+void ezNoiseImageParallel(ezThreadPool *pool, ezNoise *noise, const ezNoiseParams *params, ezImage *img) {
+    NoiseJob proto = {noise, params, NULL, img, img->w, 0, 0};
+    NoiseDispatch(pool, NoiseImageJob, &proto, img->h);
+}
+#endif
+#endif
+#endif
@@ -24,6 +24,7 @@ extern "C" {
 #endif
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <time.h>
 
 #if !defined(EZ_MALLOC)
@@ -33,50 +34,297 @@ extern "C" {
 #define EZ_FREE free
 #endif
 
+// The generator engine is chosen at compile time, xoshiro256++ is the default.
+// Define one of EZRNG_USE_PCG64, EZRNG_USE_WYRAND or EZRNG_USE_LAGGED (the
+// original 17-word lagged generator) before including to use another engine.
+#if defined(EZRNG_USE_PCG64)
+#define EZRNG_ENGINE "pcg64-dxsm"
+#elif defined(EZRNG_USE_WYRAND)
+#define EZRNG_ENGINE "wyrand"
+#elif defined(EZRNG_USE_LAGGED)
+#define EZRNG_ENGINE "lagged"
+#else
+#define EZRNG_USE_XOSHIRO256
+#define EZRNG_ENGINE "xoshiro256++"
+#endif
+
 typedef struct ezRng {
-    unsigned int seed;
+    uint64_t seed;
+#if defined(EZRNG_USE_PCG64)
+    uint64_t state[2], inc[2]; // 128-bit values stored { high, low }
+#elif defined(EZRNG_USE_WYRAND)
+    uint64_t state;
+#elif defined(EZRNG_USE_LAGGED)
     int p1, p2;
     unsigned int buffer[17];
+#else
+    uint64_t state[4];
+#endif
 } ezRng;
 
-ezRng* ezRngNew(unsigned int s);
+// Passing 0 as the seed mixes the clock, the generator's address and a
+// process-wide counter, so generators created together still differ
+ezRng* ezRngNew(uint64_t s);
+// Seed an existing generator in place, useful for generators on the stack
+void ezRngSeed(ezRng *r, uint64_t s);
 #define ezRngFree(R) EZ_FREE((R))
 
+// 64 bits of output from a single engine step
+uint64_t ezRngBits64(ezRng *r);
+// Upper 32 bits of ezRngBits64
 unsigned int ezRngBits(ezRng *r);
 float ezRngFloat(ezRng *r);
 double ezRngDouble(ezRng *r);
-#define ezRngInt(R, __MAX) (ezRngBits((R)) % __MAX)
+// Advance the generator as if it had been called 2^128 times (2^64 for PCG64,
+// 2^32 for wyrand). Repeated jumps give non-overlapping substreams of one seed.
+// The lagged engine can't jump, it is reseeded from its own output instead.
+void ezRngJump(ezRng *r);
+// As ezRngJump but 2^192 steps (2^96 for PCG64, 2^48 for wyrand), use this to
+// split off streams that will be split again with ezRngJump
+void ezRngLongJump(ezRng *r);
+// Fill `out` with `count` generators, each a jump ahead of the last, starting
+// from the current state of `r`. `r` is left a jump past the last one.
+void ezRngSplit(ezRng *r, ezRng *out, size_t count);
+
+// Generator owned by the calling thread (e.g. an ezThreadPool worker), created
+// on first use from the next substream of a shared base generator. No locks
+// are taken once a thread has its generator.
+ezRng* ezRngThreadLocal(void);
+// Seed the base generator that thread-local generators are split from, call
+// before starting any threads for reproducible per-thread streams. Without
+// this the base is seeded as if by ezRngNew(0).
+void ezRngThreadLocalSeed(uint64_t seed);
+
+// In-place Fisher-Yates shuffle of `count` elements of `size` bytes
+void ezRngShuffle(ezRng *r, void *base, size_t count, size_t size);
+// Shuffle an ezVector (see ezvector.h) of any element type
+#define ezRngShuffleVector(R, V) ezRngShuffle((R), (V), ezVectorCount((V)), sizeof(*(V)))
+
+// Streaming reservoir sampling using Li's Algorithm L, which only draws random
+// numbers for the items that enter the reservoir
+typedef struct ezRngReservoir {
+    size_t k, seen, next;
+    double w;
+} ezRngReservoir;
+
+void ezRngReservoirInit(ezRng *r, ezRngReservoir *res, size_t k);
+// Offer the next item of the stream. Returns the reservoir slot to store it in,
+// or -1 if it isn't part of the sample.
+long long ezRngReservoirOffer(ezRng *r, ezRngReservoir *res);
+// Number of upcoming items that will be rejected, these can be passed over with
+// ezRngReservoirDiscard instead of being offered one at a time
+size_t ezRngReservoirGap(ezRngReservoir *res);
+void ezRngReservoirDiscard(ezRngReservoir *res, size_t n);
+// Uniformly sample `k` of `count` elements of `size` bytes from `src` into
+// `dst`, returns the number of elements written (less than `k` if count < k)
+size_t ezRngSample(ezRng *r, const void *src, size_t count, size_t size, void *dst, size_t k);
+// Weighted sampling without replacement (Efraimidis & Spirakis' A-ExpJ). Writes
+// up to `k` indices into `out` in selection order, items with a weight <= 0 are
+// never chosen. Returns the number of indices written.
+size_t ezRngWeightedSample(ezRng *r, const double *weights, size_t count, size_t *out, size_t k);
+
+// Counter-based generation with Philox4x32-10 (Salmon et al, "Parallel Random
+// Numbers: As Easy as 1, 2, 3"). Draw `index` of `stream` under `key` is
+// computed directly from those three numbers, there is no state to share or
+// advance, so work can be split across threads arbitrarily with identical output.
+void ezRngPhilox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]);
+uint64_t ezRngCounterBits(uint64_t key, uint64_t stream, uint64_t index);
+double ezRngCounterDouble(uint64_t key, uint64_t stream, uint64_t index);
+// Draws [index, index + count) of a stream, equivalent to calling
+// ezRngCounterBits/ezRngCounterDouble for each index (vectorised with AVX2)
+void ezRngCounterFill(uint64_t key, uint64_t stream, uint64_t index, uint64_t *dst, size_t count);
+void ezRngCounterFillDouble(uint64_t key, uint64_t stream, uint64_t index, double *dst, size_t count);
+
+// Bulk generation into arrays, these run 8 independent xoshiro256++ lanes
+// seeded from `r` (in AVX2/AVX-512 registers when available). The output does
+// not depend on the instruction set, only on the state of `r`.
+void ezRngFill64(ezRng *r, uint64_t *dst, size_t count);
+void ezRngFill32(ezRng *r, uint32_t *dst, size_t count);
+void ezRngFillFloat(ezRng *r, float *dst, size_t count);
+// Doubles from bulk fills have 52 bits of precision instead of 53
+void ezRngFillDouble(ezRng *r, double *dst, size_t count);
+
+// Unbiased integer in [0, range) using Lemire's multiply-shift method
+uint32_t ezRngBounded(ezRng *r, uint32_t range);
+uint64_t ezRngBounded64(ezRng *r, uint64_t range);
+#define ezRngInt(R, __MAX) ezRngBounded((R), (uint32_t)(__MAX))
 
 #define ezRngFloatRange(R, __MIN, __MAX) (ezRngFloat((R)) * ((__MAX) - (__MIN)) + (__MIN))
 #define ezRngDoubleRange(R, __MIN, __MAX) (ezRngDouble((R)) * ((__MAX) - (__MIN)) + (__MIN))
-#define ezRngIntRange(R, __MIN, __MAX) (ezRngBits((R)) % ((__MAX) + 1 - (__MIN)) + (__MIN))
+#define ezRngIntRange(R, __MIN, __MAX) (ezRngBounded((R), (uint32_t)((__MAX) + 1 - (__MIN))) + (__MIN))
+
+// Standard normal distribution (mean 0, stddev 1) using the ziggurat method
+double ezRngNormal(ezRng *r);
+#define ezRngGaussian(R, __MEAN, __STDDEV) (ezRngNormal((R)) * (__STDDEV) + (__MEAN))
+// Exponential distribution with rate 1 using the ziggurat method
+double ezRngExponential(ezRng *r);
+uint64_t ezRngPoisson(ezRng *r, double lambda);
+uint64_t ezRngBinomial(ezRng *r, uint64_t n, double p);
+
+// Walker/Vose alias table for O(1) sampling of a discrete distribution
+typedef struct ezRngAlias {
+    uint32_t count;
+    uint32_t *alias;
+    uint64_t *threshold;
+} ezRngAlias;
+
+// `weights` don't need to be normalised, returns NULL on bad input
+ezRngAlias* ezRngAliasNew(const double *weights, uint32_t count);
+// Returns an index in [0, count) with probability proportional to its weight
+uint32_t ezRngAliasSample(ezRng *r, ezRngAlias *table);
+#define ezRngAliasFree(T) EZ_FREE((T))
 
 #if defined(__cplusplus)
 }
 #endif
 #endif // EZRNG_HEADER
 
-#if defined(EZRNG_IMPLEMENTATION) || defined(EZ_IMPLEMENTATION)
-ezRng* ezRngNew(unsigned int s) {
-    ezRng *r = EZ_MALLOC(sizeof(ezRng));
-    if (!s)
-        s = (unsigned int)time(NULL);
+#if (defined(EZRNG_IMPLEMENTATION) || defined(EZ_IMPLEMENTATION)) && !defined(EZRNG_IMPLEMENTED)
+// Guarded as other ez headers (eznoise.h) pull this one in
+#define EZRNG_IMPLEMENTED
+#include <string.h>
+#include <math.h>
+#if !defined(EZRNG_DISABLE_SIMD)
+#if defined(__AVX512F__)
+#define EZRNG_AVX512
+#include <immintrin.h>
+#elif defined(__AVX2__)
+#define EZRNG_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RNG_THREAD_LOCAL __declspec(thread)
+static inline uint64_t RngAtomicInc(volatile uint64_t *p) {
+    return (uint64_t)_InterlockedIncrement64((volatile __int64*)p) - 1;
+}
+
+static inline int RngAtomicCas(volatile long *p, long expected, long desired) {
+    return _InterlockedCompareExchange(p, desired, expected) == expected;
+}
+
+static inline long RngAtomicLoad(volatile long *p) {
+    return _InterlockedOr(p, 0);
+}
+
+static inline void RngAtomicStore(volatile long *p, long value) {
+    _InterlockedExchange(p, value);
+}
+#else
+#if defined(__cplusplus)
+#define RNG_THREAD_LOCAL thread_local
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define RNG_THREAD_LOCAL _Thread_local
+#else
+#define RNG_THREAD_LOCAL __thread
+#endif
+static inline uint64_t RngAtomicInc(volatile uint64_t *p) {
+    return __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+}
+
+static inline int RngAtomicCas(volatile long *p, long expected, long desired) {
+    return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline long RngAtomicLoad(volatile long *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void RngAtomicStore(volatile long *p, long value) {
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+#endif
+
+static inline uint64_t RngRotl64(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t RngSplitMix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// Full 64x64 -> 128 bit multiply, returns the low half and stores the high
+static inline uint64_t RngMul128(uint64_t a, uint64_t b, uint64_t *hi) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    *hi = (uint64_t)(r >> 64);
+    return (uint64_t)r;
+#else
+    uint64_t al = a & 0xFFFFFFFF, ah = a >> 32;
+    uint64_t bl = b & 0xFFFFFFFF, bh = b >> 32;
+    uint64_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+    uint64_t mid = (ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF);
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    return (mid << 32) | (ll & 0xFFFFFFFF);
+#endif
+}
+
+#if defined(EZRNG_USE_PCG64)
+#define PCG64_CHEAP_MUL 0xDA942042E4DD58B5ull
+
+// state = state * PCG64_CHEAP_MUL + inc (mod 2^128)
+static inline void Pcg64Step(ezRng *r) {
+    uint64_t hi, lo = RngMul128(r->state[1], PCG64_CHEAP_MUL, &hi);
+    hi += r->state[0] * PCG64_CHEAP_MUL;
+    r->state[1] = lo + r->inc[1];
+    r->state[0] = hi + r->inc[0] + (r->state[1] < lo);
+}
+#endif
+
+void ezRngSeed(ezRng *r, uint64_t s) {
     r->seed = s;
+#if defined(EZRNG_USE_PCG64)
+    r->inc[0] = RngSplitMix64(&s);
+    r->inc[1] = RngSplitMix64(&s) | 1;
+    r->state[0] = r->state[1] = 0;
+    Pcg64Step(r);
+    uint64_t lo = r->state[1];
+    r->state[1] += RngSplitMix64(&s);
+    r->state[0] += RngSplitMix64(&s) + (r->state[1] < lo);
+    Pcg64Step(r);
+#elif defined(EZRNG_USE_WYRAND)
+    r->state = RngSplitMix64(&s);
+#elif defined(EZRNG_USE_LAGGED)
+    unsigned int w = (unsigned int)s;
     for (int i = 0; i < 17; i++) {
-        s = s * 0xAC564B05 + 1;
-        r->buffer[i] = s;
+        w = w * 0xAC564B05 + 1;
+        r->buffer[i] = w;
     }
     r->p1 = 0;
     r->p2 = 10;
+#else
+    for (int i = 0; i < 4; i++)
+        r->state[i] = RngSplitMix64(&s);
+#endif
+}
+
+static uint64_t RngEntropy(void *address) {
+    static volatile uint64_t counter = 0;
+    uint64_t x = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32) ^ (uint64_t)(uintptr_t)address;
+    x ^= RngAtomicInc(&counter) * 0xD1B54A32D192ED03ull;
+    return RngSplitMix64(&x);
+}
+
+ezRng* ezRngNew(uint64_t s) {
+    ezRng *r = EZ_MALLOC(sizeof(ezRng));
+    if (!s)
+        s = RngEntropy(r);
+    ezRngSeed(r, s);
     return r;
 }
 
+#if defined(EZRNG_USE_LAGGED)
 #if defined(ROTL)
 #undef ROTL
 #endif
 #define ROTL(N, R) (((N) << (R)) | ((N) >> (32 - (R))))
 
-unsigned int ezRngBits(ezRng *r) {
+static unsigned int LaggedBits(ezRng *r) {
     unsigned int result = r->buffer[r->p1] = ROTL(r->buffer[r->p2], 13) + ROTL(r->buffer[r->p1], 9);
 
     if (--r->p1 < 0)
@@ -86,25 +334,1142 @@ unsigned int ezRngBits(ezRng *r) {
 
     return result;
 }
+#endif
+
+uint64_t ezRngBits64(ezRng *r) {
+#if defined(EZRNG_USE_PCG64)
+    uint64_t hi = r->state[0];
+    uint64_t lo = r->state[1] | 1;
+    Pcg64Step(r);
+    hi ^= hi >> 32;
+    hi *= PCG64_CHEAP_MUL;
+    hi ^= hi >> 48;
+    return hi * lo;
+#elif defined(EZRNG_USE_WYRAND)
+    uint64_t hi, lo;
+    r->state += 0x2D358DCCAA6C78A5ull;
+    lo = RngMul128(r->state, r->state ^ 0x8BB84B93962EACC9ull, &hi);
+    return lo ^ hi;
+#elif defined(EZRNG_USE_LAGGED)
+    uint64_t hi = LaggedBits(r);
+    return (hi << 32) | LaggedBits(r);
+#else
+    uint64_t *s = r->state;
+    uint64_t result = RngRotl64(s[0] + s[3], 23) + s[0];
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = RngRotl64(s[3], 45);
+    return result;
+#endif
+}
+
+unsigned int ezRngBits(ezRng *r) {
+#if defined(EZRNG_USE_LAGGED)
+    return LaggedBits(r);
+#else
+    return (unsigned int)(ezRngBits64(r) >> 32);
+#endif
+}
 
 float ezRngFloat(ezRng *r) {
-    union {
-        float value;
-        unsigned int word;
-    } convert = {
-        .word = (ezRngBits(r) >> 9) | 0x3F800000};
-    return convert.value - 1.f;
+    return (float)(ezRngBits(r) >> 8) * 0x1.0p-24f;
 }
 
 double ezRngDouble(ezRng *r) {
-    unsigned int bits = ezRngBits(r);
-    union {
-        double value;
-        unsigned int words[2];
-    } convert = {
-        .words = {
-            bits << 20,
-            (bits >> 12) | 0x3FF00000}};
-    return convert.value - 1.0;
+    return (double)(ezRngBits64(r) >> 11) * 0x1.0p-53;
+}
+#if defined(EZRNG_USE_XOSHIRO256)
+static void XoshiroJump(ezRng *r, const uint64_t poly[4]) {
+    uint64_t s[4] = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++)
+        for (int b = 0; b < 64; b++) {
+            if (poly[i] & (1ull << b))
+                for (int j = 0; j < 4; j++)
+                    s[j] ^= r->state[j];
+            ezRngBits64(r);
+        }
+    memcpy(r->state, s, sizeof(s));
+}
+#elif defined(EZRNG_USE_PCG64)
+// Low 128 bits of a 128x128 multiply, values stored { high, low }
+static inline void Pcg64Mul(uint64_t out[2], const uint64_t a[2], const uint64_t b[2]) {
+    uint64_t hi, lo = RngMul128(a[1], b[1], &hi);
+    out[0] = hi + a[0] * b[1] + a[1] * b[0];
+    out[1] = lo;
+}
+
+static inline void Pcg64Add(uint64_t out[2], const uint64_t a[2], const uint64_t b[2]) {
+    uint64_t lo = a[1] + b[1];
+    out[0] = a[0] + b[0] + (lo < a[1]);
+    out[1] = lo;
+}
+
+// Brown, "Random Number Generation with Arbitrary Strides", for a stride of 2^log2
+static void Pcg64Advance(ezRng *r, int log2) {
+    uint64_t mult[2] = {0, PCG64_CHEAP_MUL}, plus[2] = {r->inc[0], r->inc[1]};
+    uint64_t one[2] = {0, 1}, tmp[2];
+    for (int i = 0; i < log2; i++) {
+        Pcg64Add(tmp, mult, one);
+        Pcg64Mul(plus, tmp, plus);
+        Pcg64Mul(mult, mult, mult);
+    }
+    Pcg64Mul(tmp, mult, r->state);
+    Pcg64Add(r->state, tmp, plus);
+}
+#endif
+
+void ezRngJump(ezRng *r) {
+#if defined(EZRNG_USE_PCG64)
+    Pcg64Advance(r, 64);
+#elif defined(EZRNG_USE_WYRAND)
+    r->state += 0x2D358DCCAA6C78A5ull << 32;
+#elif defined(EZRNG_USE_LAGGED)
+    uint64_t x = ezRngBits64(r);
+    ezRngSeed(r, RngSplitMix64(&x));
+#else
+    static const uint64_t poly[4] = {
+        0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull
+    };
+    XoshiroJump(r, poly);
+#endif
+}
+
+void ezRngLongJump(ezRng *r) {
+#if defined(EZRNG_USE_PCG64)
+    Pcg64Advance(r, 96);
+#elif defined(EZRNG_USE_WYRAND)
+    r->state += 0x2D358DCCAA6C78A5ull << 48;
+#elif defined(EZRNG_USE_LAGGED)
+    ezRngJump(r);
+#else
+    static const uint64_t poly[4] = {
+        0x76E15D3EFEFDCBBFull, 0xC5004E441C522FB3ull, 0x77710069854EE241ull, 0x39109BB02ACBE635ull
+    };
+    XoshiroJump(r, poly);
+#endif
+}
+
+void ezRngSplit(ezRng *r, ezRng *out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = *r;
+        ezRngJump(r);
+    }
+}
+
+static ezRng RngThreadBase;
+static volatile long RngThreadBaseState = 0; // 0 = unseeded, 1 = seeding, 2 = ready
+static volatile uint64_t RngThreadCounter = 0;
+static RNG_THREAD_LOCAL ezRng RngThreadState;
+static RNG_THREAD_LOCAL int RngThreadReady = 0;
+
+void ezRngThreadLocalSeed(uint64_t seed) {
+    ezRngSeed(&RngThreadBase, seed ? seed : RngEntropy(&RngThreadBase));
+    RngThreadCounter = 0;
+    RngAtomicStore(&RngThreadBaseState, 2);
+}
+
+ezRng* ezRngThreadLocal(void) {
+    if (RngThreadReady)
+        return &RngThreadState;
+    if (RngAtomicLoad(&RngThreadBaseState) != 2) {
+        if (RngAtomicCas(&RngThreadBaseState, 0, 1)) {
+            ezRngSeed(&RngThreadBase, RngEntropy(&RngThreadBase));
+            RngAtomicStore(&RngThreadBaseState, 2);
+        } else
+            while (RngAtomicLoad(&RngThreadBaseState) != 2);
+    }
+    uint64_t index = RngAtomicInc(&RngThreadCounter);
+    RngThreadState = RngThreadBase;
+    for (uint64_t i = 0; i < index; i++)
+        ezRngJump(&RngThreadState);
+    RngThreadReady = 1;
+    return &RngThreadState;
+}
+
+#define RNG_LANES 8
+#define RNG_CHUNK 512
+
+typedef struct {
+    uint64_t s[4][RNG_LANES];
+} RngLanes;
+
+static void RngLanesSeed(RngLanes *l, ezRng *r) {
+    for (int i = 0; i < RNG_LANES; i++) {
+        uint64_t x = ezRngBits64(r);
+        for (int j = 0; j < 4; j++)
+            l->s[j][i] = RngSplitMix64(&x);
+    }
+}
+
+#if defined(EZRNG_AVX2)
+#define RNG_ROTL256(X, K) _mm256_or_si256(_mm256_slli_epi64((X), (K)), _mm256_srli_epi64((X), 64 - (K)))
+
+static inline __m256i RngLanesStep256(__m256i *s0, __m256i *s1, __m256i *s2, __m256i *s3) {
+    __m256i result = _mm256_add_epi64(RNG_ROTL256(_mm256_add_epi64(*s0, *s3), 23), *s0);
+    __m256i t = _mm256_slli_epi64(*s1, 17);
+    *s2 = _mm256_xor_si256(*s2, *s0);
+    *s3 = _mm256_xor_si256(*s3, *s1);
+    *s1 = _mm256_xor_si256(*s1, *s2);
+    *s0 = _mm256_xor_si256(*s0, *s3);
+    *s2 = _mm256_xor_si256(*s2, t);
+    *s3 = RNG_ROTL256(*s3, 45);
+    return result;
+}
+#endif
+
+// Writes `blocks` * RNG_LANES words, lane i of each step goes to dst[i]
+static void RngLanesNext(RngLanes *l, uint64_t *dst, size_t blocks) {
+#if defined(EZRNG_AVX512)
+    __m512i s0 = _mm512_loadu_si512(l->s[0]);
+    __m512i s1 = _mm512_loadu_si512(l->s[1]);
+    __m512i s2 = _mm512_loadu_si512(l->s[2]);
+    __m512i s3 = _mm512_loadu_si512(l->s[3]);
+    for (size_t b = 0; b < blocks; b++, dst += RNG_LANES) {
+        __m512i result = _mm512_add_epi64(_mm512_rol_epi64(_mm512_add_epi64(s0, s3), 23), s0);
+        __m512i t = _mm512_slli_epi64(s1, 17);
+        s2 = _mm512_xor_si512(s2, s0);
+        s3 = _mm512_xor_si512(s3, s1);
+        s1 = _mm512_xor_si512(s1, s2);
+        s0 = _mm512_xor_si512(s0, s3);
+        s2 = _mm512_xor_si512(s2, t);
+        s3 = _mm512_rol_epi64(s3, 45);
+        _mm512_storeu_si512(dst, result);
+    }
+    _mm512_storeu_si512(l->s[0], s0);
+    _mm512_storeu_si512(l->s[1], s1);
+    _mm512_storeu_si512(l->s[2], s2);
+    _mm512_storeu_si512(l->s[3], s3);
+#elif defined(EZRNG_AVX2)
+    __m256i a0 = _mm256_loadu_si256((__m256i*)l->s[0]), b0 = _mm256_loadu_si256((__m256i*)(l->s[0] + 4));
+    __m256i a1 = _mm256_loadu_si256((__m256i*)l->s[1]), b1 = _mm256_loadu_si256((__m256i*)(l->s[1] + 4));
+    __m256i a2 = _mm256_loadu_si256((__m256i*)l->s[2]), b2 = _mm256_loadu_si256((__m256i*)(l->s[2] + 4));
+    __m256i a3 = _mm256_loadu_si256((__m256i*)l->s[3]), b3 = _mm256_loadu_si256((__m256i*)(l->s[3] + 4));
+    for (size_t b = 0; b < blocks; b++, dst += RNG_LANES) {
+        _mm256_storeu_si256((__m256i*)dst, RngLanesStep256(&a0, &a1, &a2, &a3));
+        _mm256_storeu_si256((__m256i*)(dst + 4), RngLanesStep256(&b0, &b1, &b2, &b3));
+    }
+    _mm256_storeu_si256((__m256i*)l->s[0], a0); _mm256_storeu_si256((__m256i*)(l->s[0] + 4), b0);
+    _mm256_storeu_si256((__m256i*)l->s[1], a1); _mm256_storeu_si256((__m256i*)(l->s[1] + 4), b1);
+    _mm256_storeu_si256((__m256i*)l->s[2], a2); _mm256_storeu_si256((__m256i*)(l->s[2] + 4), b2);
+    _mm256_storeu_si256((__m256i*)l->s[3], a3); _mm256_storeu_si256((__m256i*)(l->s[3] + 4), b3);
+#else
+    uint64_t *s0 = l->s[0], *s1 = l->s[1], *s2 = l->s[2], *s3 = l->s[3];
+    for (size_t b = 0; b < blocks; b++, dst += RNG_LANES)
+        for (int i = 0; i < RNG_LANES; i++) {
+            dst[i] = RngRotl64(s0[i] + s3[i], 23) + s0[i];
+            uint64_t t = s1[i] << 17;
+            s2[i] ^= s0[i];
+            s3[i] ^= s1[i];
+            s1[i] ^= s2[i];
+            s0[i] ^= s3[i];
+            s2[i] ^= t;
+            s3[i] = RngRotl64(s3[i], 45);
+        }
+#endif
+}
+
+// Calls `emit` with chunks of random words, `words` in total. Short requests
+// are served directly from `r` as seeding the lanes isn't worth it.
+static void RngFillChunks(ezRng *r, size_t words, void(*emit)(const uint64_t*, size_t, size_t, void*), void *userdata) {
+    uint64_t buf[RNG_CHUNK];
+    if (words < RNG_LANES * 4) {
+        for (size_t i = 0; i < words; i++)
+            buf[i] = ezRngBits64(r);
+        emit(buf, 0, words, userdata);
+        return;
+    }
+    RngLanes lanes;
+    RngLanesSeed(&lanes, r);
+    for (size_t offset = 0; offset < words; offset += RNG_CHUNK) {
+        size_t n = words - offset < RNG_CHUNK ? words - offset : RNG_CHUNK;
+        RngLanesNext(&lanes, buf, (n + RNG_LANES - 1) / RNG_LANES);
+        emit(buf, offset, n, userdata);
+    }
+}
+
+static void RngEmit64(const uint64_t *src, size_t offset, size_t n, void *dst) {
+    memcpy((uint64_t*)dst + offset, src, n * sizeof(uint64_t));
+}
+
+void ezRngFill64(ezRng *r, uint64_t *dst, size_t count) {
+    RngFillChunks(r, count, RngEmit64, dst);
+}
+
+typedef struct {
+    void *dst;
+    size_t count;
+} RngFillTarget;
+
+static void RngEmit32(const uint64_t *src, size_t offset, size_t n, void *userdata) {
+    RngFillTarget *target = (RngFillTarget*)userdata;
+    size_t count = target->count - offset * 2;
+    memcpy((uint32_t*)target->dst + offset * 2, src, (count < n * 2 ? count : n * 2) * sizeof(uint32_t));
+}
+
+void ezRngFill32(ezRng *r, uint32_t *dst, size_t count) {
+    RngFillTarget target = {dst, count};
+    RngFillChunks(r, (count + 1) / 2, RngEmit32, &target);
+}
+
+static void RngEmitFloat(const uint64_t *src, size_t offset, size_t n, void *userdata) {
+    RngFillTarget *target = (RngFillTarget*)userdata;
+    float *dst = (float*)target->dst + offset * 2;
+    size_t count = target->count - offset * 2;
+    if (count > n * 2)
+        count = n * 2;
+    for (size_t i = 0; i < count / 2; i++) {
+        dst[i * 2] = (float)(int32_t)((uint32_t)src[i] >> 8) * 0x1.0p-24f;
+        dst[i * 2 + 1] = (float)(int32_t)(src[i] >> 40) * 0x1.0p-24f;
+    }
+    if (count & 1)
+        dst[count - 1] = (float)(int32_t)((uint32_t)src[count / 2] >> 8) * 0x1.0p-24f;
+}
+
+void ezRngFillFloat(ezRng *r, float *dst, size_t count) {
+    RngFillTarget target = {dst, count};
+    RngFillChunks(r, (count + 1) / 2, RngEmitFloat, &target);
+}
+
+static void RngEmitDouble(const uint64_t *src, size_t offset, size_t n, void *dst) {
+    double *out = (double*)dst + offset;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bits = (src[i] >> 12) | 0x3FF0000000000000ull;
+        double d;
+        memcpy(&d, &bits, sizeof(double));
+        out[i] = d - 1.0;
+    }
+}
+
+void ezRngFillDouble(ezRng *r, double *dst, size_t count) {
+    RngFillChunks(r, count, RngEmitDouble, dst);
+}
+
+uint32_t ezRngBounded(ezRng *r, uint32_t range) {
+    uint64_t m = (uint64_t)ezRngBits(r) * range;
+    uint32_t l = (uint32_t)m;
+    if (l < range) {
+        uint32_t t = -range % range;
+        while (l < t) {
+            m = (uint64_t)ezRngBits(r) * range;
+            l = (uint32_t)m;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+uint64_t ezRngBounded64(ezRng *r, uint64_t range) {
+    uint64_t hi, lo = RngMul128(ezRngBits64(r), range, &hi);
+    if (lo < range) {
+        uint64_t t = -range % range;
+        while (lo < t)
+            lo = RngMul128(ezRngBits64(r), range, &hi);
+    }
+    return hi;
+}
+
+// Uniform double in (0, 1], safe to pass to log()
+static inline double RngOpenDouble(ezRng *r) {
+    return 1.0 - ezRngDouble(r);
+}
+
+#define ZIGGURAT_NORMAL_R 3.442619855899
+#define ZIGGURAT_EXP_R 7.697117470131487
+
+static volatile long RngZigguratState = 0; // 0 = empty, 1 = building, 2 = ready
+static struct {
+    uint32_t kn[128], ke[256];
+    double wn[128], fn[128], we[256], fe[256];
+} RngZiggurat;
+
+// Marsaglia & Tsang, "The Ziggurat Method for Generating Random Variables"
+static void RngZigguratInit(void) {
+    double m1 = 2147483648.0, m2 = 4294967296.0;
+    double dn = ZIGGURAT_NORMAL_R, tn = dn, vn = 9.91256303526217e-3;
+    double q = vn / exp(-.5 * dn * dn);
+    RngZiggurat.kn[0] = (uint32_t)((dn / q) * m1);
+    RngZiggurat.kn[1] = 0;
+    RngZiggurat.wn[0] = q / m1;
+    RngZiggurat.wn[127] = dn / m1;
+    RngZiggurat.fn[0] = 1.;
+    RngZiggurat.fn[127] = exp(-.5 * dn * dn);
+    for (int i = 126; i >= 1; i--) {
+        dn = sqrt(-2. * log(vn / dn + exp(-.5 * dn * dn)));
+        RngZiggurat.kn[i + 1] = (uint32_t)((dn / tn) * m1);
+        tn = dn;
+        RngZiggurat.fn[i] = exp(-.5 * dn * dn);
+        RngZiggurat.wn[i] = dn / m1;
+    }
+
+    double de = ZIGGURAT_EXP_R, te = de, ve = 3.949659822581572e-3;
+    q = ve / exp(-de);
+    RngZiggurat.ke[0] = (uint32_t)((de / q) * m2);
+    RngZiggurat.ke[1] = 0;
+    RngZiggurat.we[0] = q / m2;
+    RngZiggurat.we[255] = de / m2;
+    RngZiggurat.fe[0] = 1.;
+    RngZiggurat.fe[255] = exp(-de);
+    for (int i = 254; i >= 1; i--) {
+        de = -log(ve / de + exp(-de));
+        RngZiggurat.ke[i + 1] = (uint32_t)((de / te) * m2);
+        te = de;
+        RngZiggurat.fe[i] = exp(-de);
+        RngZiggurat.we[i] = de / m2;
+    }
+}
+
+// Built once by whichever thread gets there first, the others wait for the
+// release store so they never sample from a half written table
+static inline void RngZigguratReady(void) {
+    if (RngAtomicLoad(&RngZigguratState) == 2)
+        return;
+    if (RngAtomicCas(&RngZigguratState, 0, 1)) {
+        RngZigguratInit();
+        RngAtomicStore(&RngZigguratState, 2);
+    } else
+        while (RngAtomicLoad(&RngZigguratState) != 2);
+}
+
+double ezRngNormal(ezRng *r) {
+    RngZigguratReady();
+    for (;;) {
+        // Layer index and sample come from separate bits of the same draw
+        uint64_t bits = ezRngBits64(r);
+        uint32_t i = bits & 127;
+        int32_t j = (int32_t)(bits >> 32);
+        uint32_t aj = j < 0 ? 0u - (uint32_t)j : (uint32_t)j;
+        if (aj < RngZiggurat.kn[i])
+            return j * RngZiggurat.wn[i];
+        if (!i) {
+            double x, y;
+            do {
+                x = -log(RngOpenDouble(r)) / ZIGGURAT_NORMAL_R;
+                y = -log(RngOpenDouble(r));
+            } while (y + y < x * x);
+            return j > 0 ? ZIGGURAT_NORMAL_R + x : -ZIGGURAT_NORMAL_R - x;
+        }
+        double x = j * RngZiggurat.wn[i];
+        if (RngZiggurat.fn[i] + ezRngDouble(r) * (RngZiggurat.fn[i - 1] - RngZiggurat.fn[i]) < exp(-.5 * x * x))
+            return x;
+    }
+}
+
+double ezRngExponential(ezRng *r) {
+    RngZigguratReady();
+    for (;;) {
+        uint64_t bits = ezRngBits64(r);
+        uint32_t i = bits & 255;
+        uint32_t j = (uint32_t)(bits >> 32);
+        if (j < RngZiggurat.ke[i])
+            return j * RngZiggurat.we[i];
+        if (!i)
+            return ZIGGURAT_EXP_R - log(RngOpenDouble(r));
+        double x = j * RngZiggurat.we[i];
+        if (RngZiggurat.fe[i] + ezRngDouble(r) * (RngZiggurat.fe[i - 1] - RngZiggurat.fe[i]) < exp(-x))
+            return x;
+    }
 }
+
+uint64_t ezRngPoisson(ezRng *r, double lambda) {
+    if (lambda <= 0.)
+        return 0;
+    if (lambda < 10.) {
+        // Multiplication method, cheap for small means
+        double limit = exp(-lambda), prod = ezRngDouble(r);
+        uint64_t k = 0;
+        while (prod > limit) {
+            k++;
+            prod *= ezRngDouble(r);
+        }
+        return k;
+    }
+    // Hörmann's PTRS, "The transformed rejection method for generating Poisson random variables"
+    double slam = sqrt(lambda), loglam = log(lambda);
+    double b = 0.931 + 2.53 * slam;
+    double a = -0.059 + 0.02483 * b;
+    double invalpha = 1.1239 + 1.1328 / (b - 3.4);
+    double vr = 0.9277 - 3.6224 / (b - 2);
+    for (;;) {
+        double u = ezRngDouble(r) - 0.5;
+        double v = ezRngDouble(r);
+        double us = 0.5 - fabs(u);
+        double k = floor((2 * a / us + b) * u + lambda + 0.43);
+        if (us >= 0.07 && v <= vr)
+            return (uint64_t)k;
+        if (k < 0 || (us < 0.013 && v > us))
+            continue;
+        if (log(v) + log(invalpha) - log(a / (us * us) + b) <= -lambda + k * loglam - lgamma(k + 1))
+            return (uint64_t)k;
+    }
+}
+
+uint64_t ezRngBinomial(ezRng *r, uint64_t n, double p) {
+    if (!n || p <= 0.)
+        return 0;
+    if (p >= 1.)
+        return n;
+    if (p > 0.5)
+        return n - ezRngBinomial(r, n, 1. - p);
+    double q = 1. - p, np = n * p;
+    if (np < 10.) {
+        // Inversion, walking the pmf from 0
+        double qn = exp(n * log(q));
+        double bound = np + 10. * sqrt(np * q + 1);
+        if (bound > n)
+            bound = (double)n;
+        uint64_t x = 0;
+        double px = qn, u = ezRngDouble(r);
+        while (u > px) {
+            if (++x > bound) {
+                x = 0;
+                px = qn;
+                u = ezRngDouble(r);
+            } else {
+                u -= px;
+                px = ((n - x + 1) * p * px) / (x * q);
+            }
+        }
+        return x;
+    }
+    // Hörmann's BTRS, "The generation of binomial random variates"
+    double spq = sqrt(np * q);
+    double b = 1.15 + 2.53 * spq;
+    double a = -0.0873 + 0.0248 * b + 0.01 * p;
+    double c = np + 0.5;
+    double vr = 0.92 - 4.2 / b;
+    double alpha = (2.83 + 5.1 / b) * spq;
+    double lpq = log(p / q);
+    double m = floor((n + 1) * p);
+    double h = lgamma(m + 1) + lgamma(n - m + 1);
+    for (;;) {
+        double u = ezRngDouble(r) - 0.5;
+        double v = ezRngDouble(r);
+        double us = 0.5 - fabs(u);
+        double k = floor((2 * a / us + b) * u + c);
+        if (k < 0 || k > n)
+            continue;
+        if (us >= 0.07 && v <= vr)
+            return (uint64_t)k;
+        v = log(v * alpha / (a / (us * us) + b));
+        if (v <= h - lgamma(k + 1) - lgamma(n - k + 1) + (k - m) * lpq)
+            return (uint64_t)k;
+    }
+}
+
+ezRngAlias* ezRngAliasNew(const double *weights, uint32_t count) {
+    if (!weights || !count)
+        return NULL;
+    double sum = 0.;
+    for (uint32_t i = 0; i < count; i++) {
+        if (weights[i] < 0.)
+            return NULL;
+        sum += weights[i];
+    }
+    if (sum <= 0.)
+        return NULL;
+
+    ezRngAlias *table = EZ_MALLOC(sizeof(ezRngAlias) + count * (sizeof(uint64_t) + sizeof(uint32_t)));
+    table->count = count;
+    table->threshold = (uint64_t*)(table + 1);
+    table->alias = (uint32_t*)(table->threshold + count);
+
+    // Vose's method, `work` holds the small stack from the front and the large from the back
+    double *scaled = EZ_MALLOC(count * sizeof(double));
+    uint32_t *work = EZ_MALLOC(count * sizeof(uint32_t));
+    uint32_t small = 0, large = count;
+    for (uint32_t i = 0; i < count; i++) {
+        scaled[i] = weights[i] * count / sum;
+        if (scaled[i] < 1.)
+            work[small++] = i;
+        else
+            work[--large] = i;
+    }
+    while (small && large < count) {
+        uint32_t s = work[--small], l = work[large++];
+        table->threshold[s] = (uint64_t)(scaled[s] * 4294967296.0);
+        table->alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.;
+        if (scaled[l] < 1.)
+            work[small++] = l;
+        else
+            work[--large] = l;
+    }
+    // Anything left over is within rounding error of 1
+    while (large < count) {
+        uint32_t l = work[large++];
+        table->threshold[l] = 4294967296ull;
+        table->alias[l] = l;
+    }
+    while (small) {
+        uint32_t s = work[--small];
+        table->threshold[s] = 4294967296ull;
+        table->alias[s] = s;
+    }
+    EZ_FREE(scaled);
+    EZ_FREE(work);
+    return table;
+}
+
+uint32_t ezRngAliasSample(ezRng *r, ezRngAlias *table) {
+    uint32_t i = ezRngBounded(r, table->count);
+    uint32_t coin = ezRngBits(r);
+    return coin < table->threshold[i] ? i : table->alias[i];
+}
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+void ezRngPhilox(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4]) {
+    uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c1 = (uint32_t)p1;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c3 = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+// Each Philox block holds two consecutive draws of a stream
+static inline void RngCounterBlock(uint64_t key, uint64_t stream, uint64_t block, uint64_t out[2]) {
+    uint32_t c[4] = {(uint32_t)block, (uint32_t)(block >> 32), (uint32_t)stream, (uint32_t)(stream >> 32)};
+    uint32_t k[2] = {(uint32_t)key, (uint32_t)(key >> 32)};
+    uint32_t o[4];
+    ezRngPhilox(c, k, o);
+    out[0] = o[0] | ((uint64_t)o[1] << 32);
+    out[1] = o[2] | ((uint64_t)o[3] << 32);
+}
+
+uint64_t ezRngCounterBits(uint64_t key, uint64_t stream, uint64_t index) {
+    uint64_t out[2];
+    RngCounterBlock(key, stream, index >> 1, out);
+    return out[index & 1];
+}
+
+double ezRngCounterDouble(uint64_t key, uint64_t stream, uint64_t index) {
+    return (double)(ezRngCounterBits(key, stream, index) >> 11) * 0x1.0p-53;
+}
+
+#if defined(EZRNG_AVX2) || defined(EZRNG_AVX512)
+// Four Philox blocks at once, one per 64-bit lane with the 32-bit words in the low halves
+static void RngCounterBlocks256(uint64_t key, uint64_t stream, uint64_t block, uint64_t *dst, size_t blocks) {
+    const __m256i lo32 = _mm256_set1_epi64x(0xFFFFFFFF);
+    const __m256i m0 = _mm256_set1_epi64x(PHILOX_M0), m1 = _mm256_set1_epi64x(PHILOX_M1);
+    const __m256i s0 = _mm256_set1_epi64x((uint32_t)stream), s1 = _mm256_set1_epi64x((uint32_t)(stream >> 32));
+    __m256i b = _mm256_add_epi64(_mm256_set1_epi64x((long long)block), _mm256_setr_epi64x(0, 1, 2, 3));
+    for (size_t i = 0; i + 4 <= blocks; i += 4, dst += 8) {
+        __m256i c0 = _mm256_and_si256(b, lo32), c1 = _mm256_srli_epi64(b, 32), c2 = s0, c3 = s1;
+        uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+        for (int round = 0; round < 10; round++) {
+            __m256i p0 = _mm256_mul_epu32(c0, m0);
+            __m256i p1 = _mm256_mul_epu32(c2, m1);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p1, 32), c1), _mm256_set1_epi64x(k0));
+            c1 = _mm256_and_si256(p1, lo32);
+            c2 = _mm256_xor_si256(_mm256_xor_si256(_mm256_srli_epi64(p0, 32), c3), _mm256_set1_epi64x(k1));
+            c3 = _mm256_and_si256(p0, lo32);
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        __m256i even = _mm256_or_si256(c0, _mm256_slli_epi64(c1, 32));
+        __m256i odd = _mm256_or_si256(c2, _mm256_slli_epi64(c3, 32));
+        __m256i lo = _mm256_unpacklo_epi64(even, odd), hi = _mm256_unpackhi_epi64(even, odd);
+        _mm256_storeu_si256((__m256i*)dst, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(dst + 4), _mm256_permute2x128_si256(lo, hi, 0x31));
+        b = _mm256_add_epi64(b, _mm256_set1_epi64x(4));
+    }
+}
+#endif
+
+void ezRngCounterFill(uint64_t key, uint64_t stream, uint64_t index, uint64_t *dst, size_t count) {
+    if (!count)
+        return;
+    if (index & 1) {
+        *dst++ = ezRngCounterBits(key, stream, index++);
+        count--;
+    }
+    uint64_t block = index >> 1;
+    size_t blocks = count >> 1, done = 0;
+#if defined(EZRNG_AVX2) || defined(EZRNG_AVX512)
+    done = blocks & ~(size_t)3;
+    RngCounterBlocks256(key, stream, block, dst, done);
+#endif
+    for (size_t i = done; i < blocks; i++)
+        RngCounterBlock(key, stream, block + i, dst + i * 2);
+    if (count & 1)
+        dst[count - 1] = ezRngCounterBits(key, stream, index + count - 1);
+}
+
+void ezRngCounterFillDouble(uint64_t key, uint64_t stream, uint64_t index, double *dst, size_t count) {
+    uint64_t buf[RNG_CHUNK];
+    for (size_t offset = 0; offset < count; offset += RNG_CHUNK) {
+        size_t n = count - offset < RNG_CHUNK ? count - offset : RNG_CHUNK;
+        ezRngCounterFill(key, stream, index + offset, buf, n);
+        for (size_t i = 0; i < n; i++)
+            dst[offset + i] = (double)(buf[i] >> 11) * 0x1.0p-53;
+    }
+}
+
+// Two bounded integers from a single draw, Brackett-Rozinsky & Lemire's
+// "Batched Ranged Random Integer Generation". n1 * n2 must fit in 64 bits.
+static inline void RngBoundedPair(ezRng *r, uint64_t n1, uint64_t n2, uint64_t *j1, uint64_t *j2) {
+    uint64_t product = n1 * n2;
+    uint64_t x = RngMul128(RngMul128(ezRngBits64(r), n1, j1), n2, j2);
+    if (x < product) {
+        uint64_t t = -product % product;
+        while (x < t)
+            x = RngMul128(RngMul128(ezRngBits64(r), n1, j1), n2, j2);
+    }
+}
+
+static inline void RngSwap(unsigned char *base, size_t a, size_t b, size_t size) {
+    switch (size) {
+        case 4: {
+            uint32_t t;
+            memcpy(&t, base + a * 4, 4);
+            memcpy(base + a * 4, base + b * 4, 4);
+            memcpy(base + b * 4, &t, 4);
+            break;
+        }
+        case 8: {
+            uint64_t t;
+            memcpy(&t, base + a * 8, 8);
+            memcpy(base + a * 8, base + b * 8, 8);
+            memcpy(base + b * 8, &t, 8);
+            break;
+        }
+        default: {
+            unsigned char t[64], *pa = base + a * size, *pb = base + b * size;
+            for (size_t i = 0; i < size; i += sizeof(t)) {
+                size_t n = size - i < sizeof(t) ? size - i : sizeof(t);
+                memcpy(t, pa + i, n);
+                memcpy(pa + i, pb + i, n);
+                memcpy(pb + i, t, n);
+            }
+        }
+    }
+}
+
+void ezRngShuffle(ezRng *r, void *base, size_t count, size_t size) {
+    unsigned char *data = (unsigned char*)base;
+    size_t i = count;
+    for (; i > 0xFFFFFFFF; i--)
+        RngSwap(data, i - 1, ezRngBounded64(r, i), size);
+    // Below 2^32 two swaps share one draw
+    for (; i > 2; i -= 2) {
+        uint64_t j1, j2;
+        RngBoundedPair(r, i, i - 1, &j1, &j2);
+        RngSwap(data, i - 1, j1, size);
+        RngSwap(data, i - 2, j2, size);
+    }
+    if (i == 2)
+        RngSwap(data, 1, ezRngBounded(r, 2), size);
+}
+
+// Distance to the next accepted item, floor(log(u) / log(1 - w)) + 1
+static inline size_t RngReservoirJump(ezRng *r, double w) {
+    double gap = floor(log(RngOpenDouble(r)) / log(1. - w));
+    return gap < (double)(SIZE_MAX / 2) ? (size_t)gap + 1 : SIZE_MAX / 2;
+}
+
+void ezRngReservoirInit(ezRng *r, ezRngReservoir *res, size_t k) {
+    res->k = k;
+    res->seen = 0;
+    res->w = k ? exp(log(RngOpenDouble(r)) / k) : 1.;
+    res->next = k ? k - 1 + RngReservoirJump(r, res->w) : SIZE_MAX;
+}
+
+long long ezRngReservoirOffer(ezRng *r, ezRngReservoir *res) {
+    size_t i = res->seen++;
+    if (i < res->k)
+        return (long long)i;
+    if (i != res->next)
+        return -1;
+    res->w *= exp(log(RngOpenDouble(r)) / res->k);
+    res->next += RngReservoirJump(r, res->w);
+    return (long long)ezRngBounded64(r, res->k);
+}
+
+size_t ezRngReservoirGap(ezRngReservoir *res) {
+    return res->seen < res->k ? 0 : res->next - res->seen;
+}
+
+void ezRngReservoirDiscard(ezRngReservoir *res, size_t n) {
+    size_t gap = ezRngReservoirGap(res);
+    res->seen += n < gap ? n : gap;
+}
+
+size_t ezRngSample(ezRng *r, const void *src, size_t count, size_t size, void *dst, size_t k) {
+    const unsigned char *in = (const unsigned char*)src;
+    unsigned char *out = (unsigned char*)dst;
+    if (count <= k) {
+        memcpy(out, in, count * size);
+        return count;
+    }
+    ezRngReservoir res;
+    ezRngReservoirInit(r, &res, k);
+    memcpy(out, in, k * size);
+    while (res.next < count) {
+        size_t i = res.next;
+        res.seen = i;
+        size_t slot = (size_t)ezRngReservoirOffer(r, &res);
+        memcpy(out + slot * size, in + i * size, size);
+    }
+    return k;
+}
+
+typedef struct {
+    double key;
+    size_t index;
+} RngWeightedKey;
+
+// Min-heap on key, the root is the weakest member of the sample
+static void RngHeapDown(RngWeightedKey *heap, size_t n, size_t i) {
+    for (;;) {
+        size_t l = i * 2 + 1, m = i;
+        if (l < n && heap[l].key < heap[m].key)
+            m = l;
+        if (l + 1 < n && heap[l + 1].key < heap[m].key)
+            m = l + 1;
+        if (m == i)
+            return;
+        RngWeightedKey t = heap[i];
+        heap[i] = heap[m];
+        heap[m] = t;
+        i = m;
+    }
+}
+
+size_t ezRngWeightedSample(ezRng *r, const double *weights, size_t count, size_t *out, size_t k) {
+    if (!k)
+        return 0;
+    // Keys are log(u) / w, the k largest keys form the sample
+    RngWeightedKey *heap = EZ_MALLOC(k * sizeof(RngWeightedKey));
+    size_t n = 0, i = 0;
+    for (; i < count && n < k; i++)
+        if (weights[i] > 0.) {
+            heap[n].key = log(RngOpenDouble(r)) / weights[i];
+            heap[n++].index = i;
+        }
+    for (size_t j = n / 2; j-- > 0;)
+        RngHeapDown(heap, n, j);
+    if (n == k) {
+        // Exponential jumps: skip over the total weight X that would be rejected
+        double x = log(RngOpenDouble(r)) / heap[0].key;
+        for (; i < count; i++) {
+            if (weights[i] <= 0.)
+                continue;
+            x -= weights[i];
+            if (x > 0.)
+                continue;
+            double t = exp(weights[i] * heap[0].key);
+            double u = t + (1. - t) * ezRngDouble(r);
+            heap[0].key = u > 0. ? log(u) / weights[i] : heap[0].key;
+            heap[0].index = i;
+            RngHeapDown(heap, n, 0);
+            x = log(RngOpenDouble(r)) / heap[0].key;
+        }
+    }
+    // Drain the heap weakest first, filling `out` from the back
+    for (size_t j = n; j-- > 0;) {
+        out[j] = heap[0].index;
+        heap[0] = heap[j];
+        RngHeapDown(heap, j, 0);
+    }
+    EZ_FREE(heap);
+    return n;
+}
+
+#if defined(EZRNG_BENCHMARK_MAIN)
+// Throughput benchmark + statistical smoke tests, build as a standalone program:
+//
+//     cc -O2 -march=native -x c -DEZRNG_IMPLEMENTATION -DEZRNG_BENCHMARK_MAIN ezrng.h -o ezrng -lm
+//
+//     ./ezrng [bench|test|all] [seed]     run benchmarks and/or the smoke tests
+//     ./ezrng stream [source] [seed]      write raw output to stdout forever
+//
+// Sources are `bits64` (ezRngBits64), `bits32` (ezRngBits), `fill64`
+// (ezRngFill64 lanes) and `counter` (ezRngCounterBits). Pipe the stream into
+// PractRand (`./ezrng stream | RNG_test stdin64`, `stdin32` for bits32) or
+// TestU01's stdin wrapper. Only the engine compiled in is measured, rebuild
+// with EZRNG_USE_PCG64/WYRAND/LAGGED or EZRNG_DISABLE_SIMD to compare others.
+#include <stdio.h>
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#define RNG_BENCH_DRAWS (1 << 26)
+#define RNG_BENCH_BUFFER 4096
+
+typedef struct {
+    ezRng *rng;
+    uint64_t counter;
+    size_t index;
+    uint64_t buffer[RNG_BENCH_BUFFER];
+} RngSource;
+
+typedef uint64_t(*RngSourceNext)(RngSource*);
+
+static uint64_t RngSourceBits64(RngSource *s) {
+    return ezRngBits64(s->rng);
+}
+
+static uint64_t RngSourceBits32(RngSource *s) {
+    uint64_t hi = ezRngBits(s->rng);
+    return hi << 32 | ezRngBits(s->rng);
+}
+
+static uint64_t RngSourceFill64(RngSource *s) {
+    if (s->index == RNG_BENCH_BUFFER) {
+        ezRngFill64(s->rng, s->buffer, RNG_BENCH_BUFFER);
+        s->index = 0;
+    }
+    return s->buffer[s->index++];
+}
+
+static uint64_t RngSourceCounter(RngSource *s) {
+    return ezRngCounterBits(s->rng->seed, 0, s->counter++);
+}
+
+static const struct {
+    const char *name;
+    RngSourceNext next;
+} RngSources[] = {
+    {"bits64", RngSourceBits64},
+    {"bits32", RngSourceBits32},
+    {"fill64", RngSourceFill64},
+    {"counter", RngSourceCounter}
+};
+#define RNG_SOURCE_COUNT (sizeof(RngSources) / sizeof(RngSources[0]))
+
+static void RngSourceInit(RngSource *s, ezRng *r) {
+    s->rng = r;
+    s->counter = 0;
+    s->index = RNG_BENCH_BUFFER;
+}
+
+static double RngBenchSeconds(clock_t start) {
+    double s = (double)(clock() - start) / CLOCKS_PER_SEC;
+    return s > 0. ? s : 1e-9;
+}
+
+static void RngBenchReport(const char *name, double seconds, size_t draws, size_t bytes) {
+    printf("  %-22s %9.1f M/s %7.2f ns %8.2f GB/s\n", name,
+           draws / seconds * 1e-6, seconds * 1e9 / draws, bytes / seconds * 1e-9);
+}
+
+// The sink keeps the compiler from throwing away the draws being timed
+static volatile uint64_t RngBenchSink;
+
+#define RNG_BENCH_LOOP(NAME, TYPE, EXPR)                                    \
+    do {                                                                    \
+        uint64_t sink = 0;                                                  \
+        clock_t start = clock();                                            \
+        for (size_t i = 0; i < RNG_BENCH_DRAWS; i++) {                      \
+            TYPE v = (EXPR);                                                \
+            uint64_t bits = 0;                                              \
+            memcpy(&bits, &v, sizeof(v));                                   \
+            sink += bits;                                                   \
+        }                                                                   \
+        RngBenchReport((NAME), RngBenchSeconds(start), RNG_BENCH_DRAWS,     \
+                       RNG_BENCH_DRAWS * sizeof(TYPE));                     \
+        RngBenchSink += sink;                                               \
+    } while (0)
+
+#define RNG_BENCH_FILL(NAME, TYPE, CALL)                                    \
+    do {                                                                    \
+        TYPE *buf = (TYPE*)EZ_MALLOC(RNG_BENCH_BUFFER * sizeof(TYPE));      \
+        clock_t start = clock();                                            \
+        for (size_t i = 0; i < RNG_BENCH_DRAWS; i += RNG_BENCH_BUFFER) {    \
+            CALL;                                                           \
+            RngBenchSink += (uint64_t)buf[i & (RNG_BENCH_BUFFER - 1)];      \
+        }                                                                   \
+        RngBenchReport((NAME), RngBenchSeconds(start), RNG_BENCH_DRAWS,     \
+                       RNG_BENCH_DRAWS * sizeof(TYPE));                     \
+        EZ_FREE(buf);                                                       \
+    } while (0)
+
+static void RngBenchmark(ezRng *r) {
+#if defined(EZRNG_AVX512)
+    const char *simd = "avx512";
+#elif defined(EZRNG_AVX2)
+    const char *simd = "avx2";
+#else
+    const char *simd = "scalar";
+#endif
+    printf("benchmark: engine %s, bulk fills %s, %d draws each\n", EZRNG_ENGINE, simd, RNG_BENCH_DRAWS);
+    RNG_BENCH_LOOP("ezRngBits64", uint64_t, ezRngBits64(r));
+    RNG_BENCH_LOOP("ezRngBits", unsigned int, ezRngBits(r));
+    RNG_BENCH_LOOP("ezRngFloat", float, ezRngFloat(r));
+    RNG_BENCH_LOOP("ezRngDouble", double, ezRngDouble(r));
+    RNG_BENCH_LOOP("ezRngBounded(1000)", uint32_t, ezRngBounded(r, 1000));
+    RNG_BENCH_LOOP("ezRngNormal", double, ezRngNormal(r));
+    RNG_BENCH_LOOP("ezRngExponential", double, ezRngExponential(r));
+    RNG_BENCH_LOOP("ezRngCounterBits", uint64_t, ezRngCounterBits(r->seed, 0, i));
+    RNG_BENCH_FILL("ezRngFill64", uint64_t, ezRngFill64(r, buf, RNG_BENCH_BUFFER));
+    RNG_BENCH_FILL("ezRngFill32", uint32_t, ezRngFill32(r, buf, RNG_BENCH_BUFFER));
+    RNG_BENCH_FILL("ezRngFillFloat", float, ezRngFillFloat(r, buf, RNG_BENCH_BUFFER));
+    RNG_BENCH_FILL("ezRngFillDouble", double, ezRngFillDouble(r, buf, RNG_BENCH_BUFFER));
+    RNG_BENCH_FILL("ezRngCounterFill", uint64_t, ezRngCounterFill(r->seed, 0, i, buf, RNG_BENCH_BUFFER));
+}
+
+static inline int RngPopcount64(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+}
+
+// Two-sided p-value of a standard normal statistic
+static double RngNormalP(double z) {
+    return erfc(fabs(z) / sqrt(2.));
+}
+
+// NIST SP 800-22 monobit frequency and runs tests over the same bit stream
+static void RngTestBits(RngSource *s, RngSourceNext next, size_t words, double *frequency, double *runs) {
+    uint64_t ones = 0, transitions = 0, prev = 0;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w = next(s);
+        ones += RngPopcount64(w);
+        transitions += RngPopcount64((w ^ (w >> 1)) & 0x7FFFFFFFFFFFFFFFULL);
+        if (i)
+            transitions += (prev >> 63) ^ (w & 1);
+        prev = w;
+    }
+    double n = (double)words * 64., pi = ones / n;
+    *frequency = RngNormalP((ones - n / 2.) / sqrt(n / 4.));
+    double v = (double)transitions + 1., q = pi * (1. - pi);
+    *runs = fabs(pi - .5) >= 2. / sqrt(n) ? 0. : erfc(fabs(v - 2. * n * q) / (2. * sqrt(2. * n) * q));
+}
+
+static int RngCompare32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Marsaglia's birthday spacings: 4096 birthdays in a 2^32 day year give a
+// Poisson(4) count of repeated spacings per trial. The high and low 32 bits
+// of each draw are tested separately since weak generators fail in the low bits.
+#define RNG_BIRTHDAYS 4096
+#define RNG_BIRTHDAY_TRIALS 1000
+
+static double RngTestBirthday(RngSource *s, RngSourceNext next, int shift) {
+    uint32_t *days = (uint32_t*)EZ_MALLOC(RNG_BIRTHDAYS * sizeof(uint32_t));
+    const double lambda = (double)RNG_BIRTHDAYS * RNG_BIRTHDAYS * RNG_BIRTHDAYS / (4. * 4294967296.);
+    uint64_t repeats = 0;
+    for (int t = 0; t < RNG_BIRTHDAY_TRIALS; t++) {
+        for (int i = 0; i < RNG_BIRTHDAYS; i++)
+            days[i] = (uint32_t)(next(s) >> shift);
+        qsort(days, RNG_BIRTHDAYS, sizeof(uint32_t), RngCompare32);
+        for (int i = RNG_BIRTHDAYS - 1; i > 0; i--)
+            days[i] -= days[i - 1];
+        qsort(days + 1, RNG_BIRTHDAYS - 1, sizeof(uint32_t), RngCompare32);
+        for (int i = 2; i < RNG_BIRTHDAYS; i++)
+            repeats += days[i] == days[i - 1];
+    }
+    EZ_FREE(days);
+    double mean = lambda * RNG_BIRTHDAY_TRIALS;
+    return RngNormalP((repeats - mean) / sqrt(mean));
+}
+
+// p-values below this fail, below the square root of it are only suspicious
+#define RNG_TEST_ALPHA 1e-6
+
+static int RngTestReport(const char *source, const char *test, double p) {
+    const char *verdict = p < RNG_TEST_ALPHA ? "FAIL" : p < 1e-3 ? "suspicious" : "pass";
+    printf("  %-8s %-18s p = %.6f  %s\n", source, test, p, verdict);
+    return p < RNG_TEST_ALPHA;
+}
+
+static int RngSmokeTests(ezRng *r) {
+    int failures = 0;
+    RngSource *s = (RngSource*)EZ_MALLOC(sizeof(RngSource));
+    printf("smoke tests: engine %s, seed %llu\n", EZRNG_ENGINE, (unsigned long long)r->seed);
+    for (size_t i = 0; i < RNG_SOURCE_COUNT; i++) {
+        double frequency, runs;
+        RngSourceInit(s, r);
+        RngTestBits(s, RngSources[i].next, 1 << 22, &frequency, &runs);
+        failures += RngTestReport(RngSources[i].name, "frequency", frequency);
+        failures += RngTestReport(RngSources[i].name, "runs", runs);
+        failures += RngTestReport(RngSources[i].name, "birthday (high)", RngTestBirthday(s, RngSources[i].next, 32));
+        failures += RngTestReport(RngSources[i].name, "birthday (low)", RngTestBirthday(s, RngSources[i].next, 0));
+    }
+    EZ_FREE(s);
+    printf("%d failure(s)\n", failures);
+    return failures;
+}
+
+static int RngStream(ezRng *r, const char *name) {
+    RngSourceNext next = NULL;
+    for (size_t i = 0; i < RNG_SOURCE_COUNT; i++)
+        if (!strcmp(name, RngSources[i].name))
+            next = RngSources[i].next;
+    if (!next) {
+        fprintf(stderr, "unknown source \"%s\"\n", name);
+        return 1;
+    }
+#if defined(_WIN32)
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    RngSource *s = (RngSource*)EZ_MALLOC(sizeof(RngSource));
+    uint64_t *out = (uint64_t*)EZ_MALLOC(RNG_BENCH_BUFFER * sizeof(uint64_t));
+    RngSourceInit(s, r);
+    // bits32 is written as 32-bit words in the order they were drawn
+    if (next == RngSourceBits32)
+        for (uint32_t *words = (uint32_t*)out;;) {
+            for (size_t i = 0; i < RNG_BENCH_BUFFER * 2; i++)
+                words[i] = ezRngBits(r);
+            if (fwrite(words, sizeof(uint32_t), RNG_BENCH_BUFFER * 2, stdout) != RNG_BENCH_BUFFER * 2)
+                break;
+        }
+    else
+        for (;;) {
+            for (size_t i = 0; i < RNG_BENCH_BUFFER; i++)
+                out[i] = next(s);
+            if (fwrite(out, sizeof(uint64_t), RNG_BENCH_BUFFER, stdout) != RNG_BENCH_BUFFER)
+                break;
+        }
+    EZ_FREE(out);
+    EZ_FREE(s);
+    return 0;
+}
+
+int main(int argc, const char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "all";
+    int stream = !strcmp(mode, "stream");
+    const char *source = stream && argc > 2 ? argv[2] : "bits64";
+    int seedArg = stream ? 3 : 2;
+    uint64_t seed = argc > seedArg ? strtoull(argv[seedArg], NULL, 0) : 0x5EEDULL;
+    ezRng *r = ezRngNew(seed);
+    int result = 0;
+    if (stream)
+        result = RngStream(r, source);
+    else {
+        int all = !strcmp(mode, "all");
+        if (all || !strcmp(mode, "bench"))
+            RngBenchmark(r);
+        if (all || !strcmp(mode, "test"))
+            result = RngSmokeTests(r) != 0;
+        if (!all && strcmp(mode, "bench") && strcmp(mode, "test")) {
+            fprintf(stderr, "usage: %s [bench|test|all] [seed]\n       %s stream [bits64|bits32|fill64|counter] [seed]\n", argv[0], argv[0]);
+            result = 1;
+        }
+    }
+    EZ_FREE(r);
+    return result;
+}
+#endif
 #endif
@@ -41,6 +41,8 @@ extern "C" {
 #endif
 #endif
 
+#include <stdlib.h>
+
 #if !defined(EZ_MALLOC)
 #define EZ_MALLOC malloc
 #endif
@@ -488,15 +490,14 @@ struct timespec ezThreadTimeout(unsigned int milliseconds) {
 
 static void* ThreadPoolWorker(void *arg) {
     ezThreadPool *pool = (ezThreadPool*)arg;
-    while (!pool->kill) {
+    for (;;) {
+        pthread_mutex_lock(&pool->workMutex);
         while (!pool->head && !pool->kill)
             pthread_cond_wait(&pool->workCond, &pool->workMutex);
         if (pool->kill)
             break;
         
         ezThreadWork *work = pool->head;
-        if (!work)
-            break;
         if (!work->next) {
             pool->head = NULL;
             pool->tail = NULL;
@@ -508,7 +509,7 @@ static void* ThreadPoolWorker(void *arg) {
         work->func(work->arg);
         EZ_FREE(work);
         pthread_mutex_lock(&pool->workMutex);
-        if (!pool->kill && !--pool->workingCount && pool->head)
+        if (!pool->kill && !--pool->workingCount && !pool->head)
             pthread_cond_signal(&pool->workingCond);
         pthread_mutex_unlock(&pool->workMutex);
     }
@@ -527,7 +528,9 @@ ezThreadPool* ezThreadPoolNew(size_t maxThreads) {
     pthread_cond_init(&pool->workCond, NULL);
     pthread_cond_init(&pool->workingCond, NULL);
     pool->head = pool->tail = NULL;
+    pool->workingCount = 0;
     pool->threadCount = maxThreads;
+    pool->kill = 0;
     
     pthread_t thrd;
     for (int i = 0; i < maxThreads; i++) {
@@ -545,6 +548,9 @@ void ezThreadPoolDestroy(ezThreadPool *pool) {
         EZ_FREE(work);
         work = tmp;
     }
+    pool->head = pool->tail = NULL;
+    pool->kill = 1;
+    pthread_cond_broadcast(&pool->workCond);
     pthread_mutex_unlock(&pool->workMutex);
     ezThreadPoolJoin(pool);
     pthread_mutex_destroy(&pool->workMutex);